@@ -0,0 +1,386 @@
+/*
+A microbenchmark harness for the classes of this course, in one program.
+
+The classes measured here are compiled from the programs they are defined in:
+    Matrix    Lecture_06/Code_Example/2.cpp          operator*
+    Complex   Exams/Lab/Practice Exam/Test/2.cpp     operator+
+    Cart      Exams/CT/2nd batch/3.cpp               showCart()
+    stack     Lecture_01/3. Classes : A First Look/4.cpp   push() and pop()
+Every one of those is a standalone program with its own main(), so each is #included
+into a namespace of its own with main renamed. When one of the classes is changed,
+rebuild and compare the numbers with the last run to see whether the change made it
+faster or slower.
+
+How a benchmark is measured:
+  - A benchmark is a function that runs its operation a given number of times. It is
+    registered under a name with a static benchmark_registrar object.
+  - Calibration: the iteration count is increased until one batch takes at least
+    --min-sample-ms (10 ms by default), so the clock's resolution does not matter.
+  - Warmup: batches are run for --warmup-ms (50 ms) and thrown away, so caches, branch
+    predictors and CPU frequency have settled before anything is recorded.
+  - Then --samples (15) batches are timed, and the time per operation of each batch is
+    one sample. The report gives the mean, the median, the median absolute deviation
+    (MAD, a measure of noise that one outlier cannot distort) and the minimum.
+  - do_not_optimize(x) tells the compiler that x is used, so it cannot delete the work
+    that computed it, and clobber_memory() makes it assume all memory was read.
+
+Usage:
+    g++ -std=c++17 -O2 benchmarks.cpp -o benchmarks
+    ./benchmarks [--filter=REGEX] [--format=console|json|csv] [--samples=N]
+                 [--min-sample-ms=MS] [--warmup-ms=MS] [--list]
+For example, ./benchmarks --filter='^(Matrix|Complex)' --format=json > baseline.json
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <regex>
+#include <streambuf>
+#include <string>
+#include <vector>
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// Harness
+// ---------------------------------------------------------------------------
+
+// The compiler must assume value is read here, so the code that produced it stays.
+template <class T>
+inline void do_not_optimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// The compiler must assume any memory may have been read or written here.
+inline void clobber_memory()
+{
+    asm volatile("" : : : "memory");
+}
+
+typedef void (*benchmark_function)(uint64_t iterations);
+
+struct benchmark_case
+{
+    string name;
+    benchmark_function run;
+};
+
+vector<benchmark_case> &benchmark_registry()
+{
+    static vector<benchmark_case> all;
+    return all;
+}
+
+// Declare a registrar: a static object of this class adds a benchmark before main() runs.
+struct benchmark_registrar
+{
+    benchmark_registrar(const char *name, benchmark_function f) { benchmark_registry().push_back({name, f}); }
+};
+
+struct benchmark_options
+{
+    string filter = "";
+    string format = "console";
+    int samples = 15;
+    double min_sample_ms = 10;
+    double warmup_ms = 50;
+    bool list = false;
+};
+
+struct benchmark_result
+{
+    string name;
+    uint64_t iterations; // per sample
+    int samples;
+    double mean, median, mad, min; // nanoseconds per operation
+};
+
+double seconds_for(benchmark_function f, uint64_t iterations)
+{
+    auto start = chrono::steady_clock::now();
+    f(iterations);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double median_of(vector<double> v)
+{
+    sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+benchmark_result run_benchmark(const benchmark_case &b, const benchmark_options &opt)
+{
+    // Calibrate: grow the batch until it takes at least min_sample_ms.
+    double target = opt.min_sample_ms / 1e3;
+    uint64_t iterations = 1;
+    double t = seconds_for(b.run, iterations);
+    while (t < target && iterations < (1ull << 40))
+    {
+        double factor = t > 0 ? 1.4 * target / t : 10;
+        iterations = uint64_t(iterations * min(10.0, max(2.0, factor)));
+        t = seconds_for(b.run, iterations);
+    }
+
+    // Warm up, then take the samples.
+    auto warm_start = chrono::steady_clock::now();
+    while (chrono::duration<double, milli>(chrono::steady_clock::now() - warm_start).count() < opt.warmup_ms)
+        b.run(iterations);
+
+    vector<double> ns_per_op;
+    for (int s = 0; s < opt.samples; s++)
+        ns_per_op.push_back(seconds_for(b.run, iterations) * 1e9 / iterations);
+
+    benchmark_result r;
+    r.name = b.name;
+    r.iterations = iterations;
+    r.samples = opt.samples;
+    r.mean = 0;
+    for (double x : ns_per_op)
+        r.mean += x / ns_per_op.size();
+    r.median = median_of(ns_per_op);
+    vector<double> deviations;
+    for (double x : ns_per_op)
+        deviations.push_back(fabs(x - r.median));
+    r.mad = median_of(deviations);
+    r.min = *min_element(ns_per_op.begin(), ns_per_op.end());
+    return r;
+}
+
+// name as a JSON string: quotes, backslashes and control characters escaped.
+string json_string(const string &name)
+{
+    string s = "\"";
+    for (unsigned char c : name)
+    {
+        if (c < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            s += code;
+        }
+        else
+        {
+            if (c == '"' || c == '\\')
+                s += '\\';
+            s += char(c);
+        }
+    }
+    return s + "\"";
+}
+
+// name as a CSV field: quoted, with quotes doubled, if it contains a comma, quote or line break.
+string csv_field(const string &name)
+{
+    if (name.find_first_of(",\"\r\n") == string::npos)
+        return name;
+    string s = "\"";
+    for (char c : name)
+        s += c == '"' ? string("\"\"") : string(1, c);
+    return s + "\"";
+}
+
+void print_results(const vector<benchmark_result> &results, const string &format)
+{
+    if (format == "json")
+    {
+        printf("{\n  \"benchmarks\": [");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const benchmark_result &r = results[i];
+            printf("%s\n    {\"name\": %s, \"iterations\": %llu, \"samples\": %d, \"mean_ns\": %.4f, "
+                   "\"median_ns\": %.4f, \"mad_ns\": %.4f, \"min_ns\": %.4f}",
+                   i ? "," : "", json_string(r.name).c_str(), (unsigned long long)r.iterations, r.samples, r.mean,
+                   r.median, r.mad, r.min);
+        }
+        printf("\n  ]\n}\n");
+    }
+    else if (format == "csv")
+    {
+        printf("name,iterations,samples,mean_ns,median_ns,mad_ns,min_ns\n");
+        for (const benchmark_result &r : results)
+            printf("%s,%llu,%d,%.4f,%.4f,%.4f,%.4f\n", csv_field(r.name).c_str(), (unsigned long long)r.iterations,
+                   r.samples, r.mean, r.median, r.mad, r.min);
+    }
+    else
+    {
+        printf("%-28s %14s %12s %12s %10s %12s\n", "benchmark (ns/op)", "iterations", "mean", "median", "MAD", "min");
+        for (const benchmark_result &r : results)
+            printf("%-28s %14llu %12.3f %12.3f %10.3f %12.3f\n", r.name.c_str(), (unsigned long long)r.iterations,
+                   r.mean, r.median, r.mad, r.min);
+    }
+}
+
+bool parse_options(int argc, char *argv[], benchmark_options &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string key = arg.substr(0, eq), value = eq == string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--filter")
+            opt.filter = value;
+        else if (key == "--format" && (value == "console" || value == "json" || value == "csv"))
+            opt.format = value;
+        else if (key == "--samples" && atoi(value.c_str()) > 0)
+            opt.samples = atoi(value.c_str());
+        else if (key == "--min-sample-ms" && atof(value.c_str()) > 0)
+            opt.min_sample_ms = atof(value.c_str());
+        else if (key == "--warmup-ms" && atof(value.c_str()) >= 0)
+            opt.warmup_ms = atof(value.c_str());
+        else if (key == "--list")
+            opt.list = true;
+        else
+        {
+            cerr << "Unknown or invalid option: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Classes under test, from their programs
+// ---------------------------------------------------------------------------
+
+// Each program is included in a namespace of its own, with its main() renamed so that it
+// is just another function. The standard headers they include were included above, so
+// their #includes add nothing inside the namespace. (A namespace is needed anyway:
+// <regex> brings in std::stack.)
+#define main program_main
+
+namespace matrix_program
+{
+#include "../Lecture_06: Introducing Operator Overloading/Code_Example/2.cpp"
+}
+
+namespace complex_program
+{
+#include "../../Exams/Lab/Practice Exam/Test/2.cpp"
+}
+
+namespace cart_program
+{
+#include "../../Exams/CT/2nd batch/3.cpp"
+}
+
+namespace stack_program
+{
+#include "../Lecture_01: An Overview of C++/3. Classes : A First Look/4.cpp"
+}
+
+#undef main
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+// One product of a chain m = m * r, where r is a small rotation so values stay bounded.
+void bench_matrix_multiply(uint64_t iterations)
+{
+    const double angle = 0.001;
+    matrix_program::Matrix r(cos(angle), -sin(angle), sin(angle), cos(angle));
+    matrix_program::Matrix m(1, 0, 0, 1);
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        m = m * r;
+        do_not_optimize(m);
+    }
+}
+benchmark_registrar reg_matrix("Matrix/operator*", bench_matrix_multiply);
+
+void bench_complex_add(uint64_t iterations)
+{
+    complex_program::Complex sum, step(0.5f, -0.25f);
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        sum = sum + step;
+        do_not_optimize(sum);
+    }
+}
+benchmark_registrar reg_complex("Complex/operator+", bench_complex_add);
+
+// A stream buffer that throws its characters away, so showCart() can run without a terminal.
+class null_buffer : public streambuf
+{
+protected:
+    int overflow(int c) override { return c == EOF ? 0 : c; }
+    streamsize xsputn(const char *, streamsize n) override { return n; }
+};
+
+// One call of showCart() on a cart of 10 products, with cout sent to a null_buffer.
+void bench_cart_show(uint64_t iterations)
+{
+    static cart_program::Cart cart;
+    static bool filled = false;
+    if (!filled)
+    {
+        cart.addItem("Book", 4);
+        cart.addItem("Pen", 6, 1.0);
+        filled = true;
+    }
+    null_buffer sink;
+    streambuf *saved = cout.rdbuf(&sink);
+    for (uint64_t i = 0; i < iterations; i++)
+        cart.showCart();
+    cout.rdbuf(saved);
+}
+benchmark_registrar reg_cart("Cart/showCart/10_items", bench_cart_show);
+
+// Fill the stack of SIZE characters and empty it again: one operation is one push and one
+// pop. The last round is shorter if iterations is not a multiple of SIZE, so exactly
+// iterations operations are timed.
+void bench_stack_push_pop(uint64_t iterations)
+{
+    stack_program::stack s;
+    s.init();
+    char checksum = 0;
+    for (uint64_t done = 0; done < iterations;)
+    {
+        int depth = int(min<uint64_t>(SIZE, iterations - done));
+        for (int i = 0; i < depth; i++)
+            s.push(char('a' + i));
+        clobber_memory();
+        for (int i = 0; i < depth; i++)
+            checksum ^= s.pop();
+        done += depth;
+    }
+    do_not_optimize(checksum);
+}
+benchmark_registrar reg_stack("stack/push+pop", bench_stack_push_pop);
+
+int main(int argc, char *argv[])
+{
+    benchmark_options opt;
+    if (!parse_options(argc, argv, opt))
+        return 1;
+
+    regex filter;
+    try
+    {
+        filter = regex(opt.filter);
+    }
+    catch (regex_error &)
+    {
+        cerr << "Invalid --filter regular expression: " << opt.filter << "\n";
+        return 1;
+    }
+
+    vector<benchmark_result> results;
+    for (const benchmark_case &b : benchmark_registry())
+    {
+        if (!regex_search(b.name, filter))
+            continue;
+        if (opt.list)
+            cout << b.name << "\n";
+        else
+            results.push_back(run_benchmark(b, opt));
+    }
+    if (!opt.list)
+        print_results(results, opt.format);
+    return 0;
+}
@@ -0,0 +1,335 @@
+/*
+5. The stack in the previous example can hold only SIZE (10) characters and prints
+"Stack is full" when you try to push an eleventh. Here is a version of the stack class
+that can grow without limit. It is written as a template, stack<T, InlineN>, so it can
+store any type, including types that can only be moved (such as unique_ptr).
+
+The first InlineN elements are stored inside the object itself, so a shallow stack never
+touches the heap. When the stack grows past InlineN, the elements are moved to a heap
+buffer whose capacity doubles every time it fills up, so push() is O(1) amortized.
+
+main() shows the class in use and then times push/pop against the original fixed array
+stack and a std::vector-backed stack at depths 8, 1K and 1M.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 5.cpp -o stack_bench
+*/
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Declare a growable stack class with inline small-buffer storage.
+template <class T, size_t InlineN = 16>
+class stack
+{
+    static_assert(InlineN > 0, "stack needs at least one inline slot");
+
+    alignas(T) unsigned char inline_buf[InlineN * sizeof(T)]; // first InlineN elements live here
+    T *stck;    // points at inline_buf or at the heap buffer
+    size_t tos; // index of top of stack (number of elements)
+    size_t cap; // number of slots stck can hold
+
+    T *inline_data() { return reinterpret_cast<T *>(inline_buf); }
+    bool on_heap() const { return stck != reinterpret_cast<const T *>(inline_buf); }
+    void grow(size_t new_cap);
+    void release();
+    void steal(stack &other);
+
+public:
+    stack() : stck(inline_data()), tos(0), cap(InlineN) {}
+    stack(const stack &other);
+    stack(stack &&other) noexcept(is_nothrow_move_constructible<T>::value);
+    ~stack();
+
+    stack &operator=(const stack &other);
+    stack &operator=(stack &&other) noexcept(is_nothrow_move_constructible<T>::value);
+
+    void push(const T &value) { emplace(value); }
+    void push(T &&value) { emplace(std::move(value)); }
+    template <class... Args>
+    T &emplace(Args &&...args);
+    T pop();             // requires !empty()
+    T &top();            // requires !empty()
+    void clear();
+    void reserve(size_t n);
+
+    bool empty() const { return tos == 0; }
+    size_t size() const { return tos; }
+    size_t capacity() const { return cap; }
+    bool is_inline() const { return !on_heap(); }
+};
+
+// Move the elements into a buffer of new_cap slots.
+template <class T, size_t InlineN>
+void stack<T, InlineN>::grow(size_t new_cap)
+{
+    T *fresh = static_cast<T *>(::operator new(new_cap * sizeof(T)));
+    size_t moved = 0;
+    try
+    {
+        // move_if_noexcept keeps the old elements intact if a copyable T throws while moving
+        for (; moved < tos; moved++)
+            ::new (static_cast<void *>(fresh + moved)) T(std::move_if_noexcept(stck[moved]));
+    }
+    catch (...)
+    {
+        for (size_t i = 0; i < moved; i++)
+            fresh[i].~T();
+        ::operator delete(fresh);
+        throw;
+    }
+    for (size_t i = 0; i < tos; i++)
+        stck[i].~T();
+    if (on_heap())
+        ::operator delete(stck);
+    stck = fresh;
+    cap = new_cap;
+}
+
+// Destroy every element and give back the heap buffer, if any.
+template <class T, size_t InlineN>
+void stack<T, InlineN>::release()
+{
+    clear();
+    if (on_heap())
+        ::operator delete(stck);
+    stck = inline_data();
+    cap = InlineN;
+}
+
+// Take over the contents of other, leaving it empty. *this must be empty and inline.
+template <class T, size_t InlineN>
+void stack<T, InlineN>::steal(stack &other)
+{
+    if (other.on_heap())
+    {
+        // A heap buffer can simply change owners.
+        stck = other.stck;
+        cap = other.cap;
+        tos = other.tos;
+        other.stck = other.inline_data();
+        other.cap = InlineN;
+        other.tos = 0;
+        return;
+    }
+    // Inline elements have to be moved one by one.
+    for (; tos < other.tos; tos++)
+        ::new (static_cast<void *>(stck + tos)) T(std::move(other.stck[tos]));
+    other.clear();
+}
+
+template <class T, size_t InlineN>
+stack<T, InlineN>::stack(const stack &other) : stck(inline_data()), tos(0), cap(InlineN)
+{
+    reserve(other.tos);
+    for (size_t i = 0; i < other.tos; i++)
+        push(other.stck[i]);
+}
+
+template <class T, size_t InlineN>
+stack<T, InlineN>::stack(stack &&other) noexcept(is_nothrow_move_constructible<T>::value)
+    : stck(inline_data()), tos(0), cap(InlineN)
+{
+    steal(other);
+}
+
+template <class T, size_t InlineN>
+stack<T, InlineN>::~stack()
+{
+    release();
+}
+
+template <class T, size_t InlineN>
+stack<T, InlineN> &stack<T, InlineN>::operator=(const stack &other)
+{
+    if (this != &other)
+    {
+        stack copy(other); // copy first so *this is unchanged if T's copy throws
+        release();
+        steal(copy);
+    }
+    return *this;
+}
+
+template <class T, size_t InlineN>
+stack<T, InlineN> &stack<T, InlineN>::operator=(stack &&other) noexcept(is_nothrow_move_constructible<T>::value)
+{
+    if (this != &other)
+    {
+        release();
+        steal(other);
+    }
+    return *this;
+}
+
+// Construct a new element in place on top of the stack.
+template <class T, size_t InlineN>
+template <class... Args>
+T &stack<T, InlineN>::emplace(Args &&...args)
+{
+    if (tos == cap)
+        grow(cap * 2); // geometric growth keeps push() O(1) amortized
+    T *slot = ::new (static_cast<void *>(stck + tos)) T(std::forward<Args>(args)...);
+    tos++;
+    return *slot;
+}
+
+// Pop the top element. Popping an empty stack is a programming error.
+template <class T, size_t InlineN>
+T stack<T, InlineN>::pop()
+{
+    assert(tos > 0 && "pop() on an empty stack");
+    tos--;
+    T value(std::move(stck[tos]));
+    stck[tos].~T();
+    return value;
+}
+
+template <class T, size_t InlineN>
+T &stack<T, InlineN>::top()
+{
+    assert(tos > 0 && "top() on an empty stack");
+    return stck[tos - 1];
+}
+
+template <class T, size_t InlineN>
+void stack<T, InlineN>::clear()
+{
+    while (tos > 0)
+        stck[--tos].~T();
+}
+
+template <class T, size_t InlineN>
+void stack<T, InlineN>::reserve(size_t n)
+{
+    if (n > cap)
+        grow(n);
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// The fixed array stack from 4.cpp, with SIZE turned into a template parameter
+// so it can be made deep enough for each benchmark depth.
+template <size_t SIZE>
+class fixed_stack
+{
+    char stck[SIZE];
+    int tos;
+
+public:
+    fixed_stack() : tos(0) {}
+    void push(char c)
+    {
+        if (tos == (int)SIZE)
+        {
+            cout << "Stack is full\n";
+            return;
+        }
+        stck[tos] = c;
+        tos++;
+    }
+    char pop()
+    {
+        if (tos == 0)
+        {
+            cout << "Stack is empty\n";
+            return '\0';
+        }
+        tos--;
+        return stck[tos];
+    }
+};
+
+// A stack backed by std::vector, the usual "just use the library" answer.
+class vector_stack
+{
+    vector<char> stck;
+
+public:
+    void push(char c) { stck.push_back(c); }
+    char pop()
+    {
+        char c = stck.back();
+        stck.pop_back();
+        return c;
+    }
+};
+
+// Fill a stack to depth and drain it again, rounds times. Returns nanoseconds per
+// operation (one push or one pop) and folds the popped values into checksum so the
+// compiler cannot drop the work.
+template <class Stack>
+double time_push_pop(Stack &s, size_t depth, size_t rounds, unsigned long &checksum)
+{
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < depth; i++)
+            s.push(static_cast<char>('a' + (i + r) % 26));
+        for (size_t i = 0; i < depth; i++)
+            checksum += static_cast<unsigned char>(s.pop());
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration<double, nano>(end - start).count();
+    return ns / (2.0 * depth * rounds);
+}
+
+template <size_t DEPTH>
+void run_depth()
+{
+    const size_t total_ops = 32u << 20; // roughly the same amount of work at every depth
+    const size_t rounds = total_ops / (2 * DEPTH) > 0 ? total_ops / (2 * DEPTH) : 1;
+    unsigned long checksum = 0;
+
+    // The fixed stack is allocated with new so that the 1M version does not live on the call stack.
+    unique_ptr<fixed_stack<DEPTH>> fixed(new fixed_stack<DEPTH>);
+    vector_stack vec;
+    stack<char, 16> growable;
+
+    double fixed_ns = time_push_pop(*fixed, DEPTH, rounds, checksum);
+    double vec_ns = time_push_pop(vec, DEPTH, rounds, checksum);
+    double grow_ns = time_push_pop(growable, DEPTH, rounds, checksum);
+
+    cout << "depth " << DEPTH << ":\n";
+    cout << "  fixed char[SIZE]   " << fixed_ns << " ns/op\n";
+    cout << "  std::vector        " << vec_ns << " ns/op\n";
+    cout << "  stack<char, 16>    " << grow_ns << " ns/op"
+         << (growable.is_inline() ? " (inline, no heap)" : " (heap)") << "\n";
+    cout << "  (checksum " << checksum << ")\n";
+}
+
+int main()
+{
+    // The same push/pop calls as 4.cpp, but there is no longer a limit of 10.
+    stack<char, 16> s1;
+    for (char c = 'a'; c <= 'z'; c++)
+        s1.push(c);
+    cout << "s1 holds " << s1.size() << " characters, "
+         << (s1.is_inline() ? "inline" : "on the heap") << ", capacity " << s1.capacity() << "\n";
+    cout << "Popped: ";
+    while (!s1.empty())
+        cout << s1.pop() << " ";
+    cout << "\n";
+
+    // Move-only elements work too.
+    stack<unique_ptr<string>, 4> names;
+    names.push(make_unique<string>("first"));
+    names.emplace(new string("second"));
+    stack<unique_ptr<string>, 4> moved(std::move(names));
+    cout << "Top of moved stack: " << *moved.top() << ", size " << moved.size() << "\n\n";
+
+    cout << "Push/pop throughput:\n";
+    run_depth<8>();
+    run_depth<1024>();
+    run_depth<1024 * 1024>();
+    return 0;
+}
@@ -0,0 +1,440 @@
+/*
+6. The stack class in 4.cpp pushes and pops at one end, tos. If we let other threads take
+elements from the other end (the oldest ones), the stack becomes a work-stealing deque:
+the thread that owns it keeps working LIFO on the newest, cache-hot items, while idle
+threads steal the oldest items, which in a recursive program are the biggest pieces of
+work.
+
+This program implements the Chase-Lev deque (as corrected for C11 atomics by Le, Pop,
+Cohen and Zappa Nardelli) as a template, work_deque<T>:
+    push(x)   owner only, adds x at tos
+    pop(x)    owner only, removes the element at tos (LIFO)
+    steal(x)  any thread, removes the element at bottom (FIFO)
+The buffer is circular and doubles when it fills. Thieves may still be reading an old
+buffer after a resize, so old buffers are only freed when the deque is destroyed.
+
+On top of it sits thread_pool, with one deque per worker thread:
+    spawn(group, f)  queue the task f as part of group
+    sync(group)      wait until every task in group has finished
+A thread waiting in sync() does not block; it keeps running tasks from its own deque
+and steals from the others, so recursive spawn/sync does not deadlock and keeps all
+cores busy. main() measures the scaling of parallel Fibonacci and parallel quicksort
+from 1 thread up to all hardware threads (or up to the count given on the command line).
+
+Compile and run with:
+    g++ -std=c++17 -O2 -pthread 6.cpp -o work_stealing
+    ./work_stealing [max_threads]
+*/
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Declare a work-stealing deque. T must be trivially copyable (typically a pointer).
+template <class T>
+class work_deque
+{
+    static_assert(is_trivially_copyable<T>::value, "work_deque elements must be trivially copyable");
+
+    struct ring
+    {
+        int64_t size; // always a power of two
+        atomic<T> *slots;
+
+        explicit ring(int64_t n) : size(n), slots(new atomic<T>[n]) {}
+        ~ring() { delete[] slots; }
+        T get(int64_t i) const { return slots[i & (size - 1)].load(memory_order_relaxed); }
+        void put(int64_t i, T x) { slots[i & (size - 1)].store(x, memory_order_relaxed); }
+    };
+
+    alignas(64) atomic<int64_t> tos;    // next free slot at the owner's end
+    alignas(64) atomic<int64_t> bottom; // oldest element, where thieves take from
+    alignas(64) atomic<ring *> buffer;
+    vector<ring *> retired; // old buffers, touched only by the owner
+
+    ring *grow(ring *old, int64_t t, int64_t b);
+
+public:
+    explicit work_deque(int64_t capacity = 256);
+    ~work_deque();
+    work_deque(const work_deque &) = delete;
+    work_deque &operator=(const work_deque &) = delete;
+
+    void push(T x);     // owner only
+    bool pop(T &out);   // owner only; false if empty
+    bool steal(T &out); // any thread; false if empty or if another thread won the race
+    bool empty() const { return bottom.load(memory_order_relaxed) >= tos.load(memory_order_relaxed); }
+};
+
+template <class T>
+work_deque<T>::work_deque(int64_t capacity) : tos(0), bottom(0)
+{
+    int64_t n = 1;
+    while (n < capacity)
+        n *= 2;
+    buffer.store(new ring(n), memory_order_relaxed);
+}
+
+template <class T>
+work_deque<T>::~work_deque()
+{
+    delete buffer.load();
+    for (ring *r : retired)
+        delete r;
+}
+
+// Copy the live elements into a ring twice as big.
+template <class T>
+typename work_deque<T>::ring *work_deque<T>::grow(ring *old, int64_t t, int64_t b)
+{
+    ring *bigger = new ring(old->size * 2);
+    for (int64_t i = b; i < t; i++)
+        bigger->put(i, old->get(i));
+    retired.push_back(old);
+    buffer.store(bigger, memory_order_release);
+    return bigger;
+}
+
+template <class T>
+void work_deque<T>::push(T x)
+{
+    int64_t t = tos.load(memory_order_relaxed);
+    int64_t b = bottom.load(memory_order_acquire);
+    ring *r = buffer.load(memory_order_relaxed);
+    if (t - b > r->size - 1)
+        r = grow(r, t, b);
+    r->put(t, x);
+    atomic_thread_fence(memory_order_release);
+    tos.store(t + 1, memory_order_relaxed);
+}
+
+template <class T>
+bool work_deque<T>::pop(T &out)
+{
+    int64_t t = tos.load(memory_order_relaxed) - 1;
+    ring *r = buffer.load(memory_order_relaxed);
+    tos.store(t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = bottom.load(memory_order_relaxed);
+
+    if (b > t)
+    {
+        // Empty: undo the decrement.
+        tos.store(t + 1, memory_order_relaxed);
+        return false;
+    }
+    out = r->get(t);
+    if (b == t)
+    {
+        // Last element: race the thieves for it.
+        bool won = bottom.compare_exchange_strong(b, b + 1, memory_order_seq_cst, memory_order_relaxed);
+        tos.store(t + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template <class T>
+bool work_deque<T>::steal(T &out)
+{
+    int64_t b = bottom.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = tos.load(memory_order_acquire);
+    if (b >= t)
+        return false;
+
+    ring *r = buffer.load(memory_order_acquire);
+    T x = r->get(b);
+    if (!bottom.compare_exchange_strong(b, b + 1, memory_order_seq_cst, memory_order_relaxed))
+        return false; // lost the race to another thief or to the owner
+    out = x;
+    return true;
+}
+
+// A set of tasks that can be waited for with thread_pool::sync().
+class task_group
+{
+    friend class thread_pool;
+    atomic<long> pending;
+
+public:
+    task_group() : pending(0) {}
+    task_group(const task_group &) = delete;
+    task_group &operator=(const task_group &) = delete;
+};
+
+// A work-stealing thread pool with one work_deque per worker.
+class thread_pool
+{
+    struct task
+    {
+        task_group *group;
+        virtual ~task() {}
+        virtual void run() = 0;
+    };
+
+    template <class F>
+    struct task_impl : task
+    {
+        F fn;
+        explicit task_impl(F f) : fn(std::move(f)) {}
+        void run() override { fn(); }
+    };
+
+    struct worker
+    {
+        work_deque<task *> tasks;
+        thread th;
+    };
+
+    vector<worker *> workers;
+    mutex inject_lock;       // guards injected
+    vector<task *> injected; // tasks spawned by threads that are not workers
+    atomic<long> injected_count;
+    atomic<bool> stopping;
+
+    static thread_local thread_pool *current_pool;
+    static thread_local int current_index; // worker index of this thread, or -1
+
+    void worker_loop(int index);
+    task *find_task(int self, unsigned &seed);
+    void execute(task *t);
+
+public:
+    explicit thread_pool(unsigned threads = thread::hardware_concurrency());
+    ~thread_pool();
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    template <class F>
+    void spawn(task_group &group, F f);
+    void sync(task_group &group);
+    unsigned size() const { return unsigned(workers.size()); }
+};
+
+thread_local thread_pool *thread_pool::current_pool = nullptr;
+thread_local int thread_pool::current_index = -1;
+
+thread_pool::thread_pool(unsigned threads) : injected_count(0), stopping(false)
+{
+    if (threads == 0)
+        threads = 1;
+    for (unsigned i = 0; i < threads; i++)
+        workers.push_back(new worker);
+    // Start the threads only after every deque exists, since they steal from each other.
+    for (unsigned i = 0; i < threads; i++)
+        workers[i]->th = thread(&thread_pool::worker_loop, this, int(i));
+}
+
+thread_pool::~thread_pool()
+{
+    stopping.store(true);
+    for (worker *w : workers)
+    {
+        w->th.join();
+        delete w;
+    }
+    for (task *t : injected)
+        delete t;
+}
+
+template <class F>
+void thread_pool::spawn(task_group &group, F f)
+{
+    task *t = new task_impl<F>(std::move(f));
+    t->group = &group;
+    group.pending.fetch_add(1, memory_order_relaxed);
+
+    if (current_pool == this)
+    {
+        workers[current_index]->tasks.push(t);
+        return;
+    }
+    lock_guard<mutex> guard(inject_lock);
+    injected.push_back(t);
+    injected_count.fetch_add(1, memory_order_release);
+}
+
+// Own deque first (newest work, LIFO), then steal from a random victim (oldest work),
+// then the tasks injected from outside the pool.
+thread_pool::task *thread_pool::find_task(int self, unsigned &seed)
+{
+    task *t = nullptr;
+    if (self >= 0 && workers[self]->tasks.pop(t))
+        return t;
+
+    unsigned n = unsigned(workers.size());
+    seed = seed * 1103515245u + 12345u;
+    unsigned start = (seed >> 8) % n;
+    for (unsigned i = 0; i < n; i++)
+    {
+        unsigned victim = (start + i) % n;
+        if (int(victim) != self && workers[victim]->tasks.steal(t))
+            return t;
+    }
+
+    if (injected_count.load(memory_order_acquire) > 0)
+    {
+        lock_guard<mutex> guard(inject_lock);
+        if (!injected.empty())
+        {
+            t = injected.back();
+            injected.pop_back();
+            injected_count.fetch_sub(1, memory_order_relaxed);
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+void thread_pool::execute(task *t)
+{
+    task_group *group = t->group;
+    t->run();
+    delete t;
+    group->pending.fetch_sub(1, memory_order_release);
+}
+
+void thread_pool::worker_loop(int index)
+{
+    current_pool = this;
+    current_index = index;
+    unsigned seed = unsigned(index) * 2654435761u + 1;
+    int idle = 0;
+    while (!stopping.load(memory_order_relaxed))
+    {
+        task *t = find_task(index, seed);
+        if (t)
+        {
+            execute(t);
+            idle = 0;
+        }
+        else if (++idle < 64)
+            this_thread::yield();
+        else
+            this_thread::sleep_for(chrono::microseconds(50));
+    }
+}
+
+// Wait for group, running other tasks in the meantime.
+void thread_pool::sync(task_group &group)
+{
+    int self = current_pool == this ? current_index : -1;
+    unsigned seed = unsigned(self + 2) * 40503u;
+    while (group.pending.load(memory_order_acquire) > 0)
+    {
+        task *t = find_task(self, seed);
+        if (t)
+            execute(t);
+        else
+            this_thread::yield();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark: recursive Fibonacci and quicksort
+// ---------------------------------------------------------------------------
+
+long fib_serial(int n)
+{
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+// Spawn down to cutoff, then finish serially, so each task still does a few microseconds of work.
+long fib_parallel(thread_pool &pool, int n, int cutoff)
+{
+    if (n <= cutoff)
+        return fib_serial(n);
+    long a = 0;
+    task_group g;
+    pool.spawn(g, [&pool, &a, n, cutoff] { a = fib_parallel(pool, n - 1, cutoff); });
+    long b = fib_parallel(pool, n - 2, cutoff);
+    pool.sync(g);
+    return a + b;
+}
+
+void quicksort_parallel(thread_pool &pool, int *first, int *last, long cutoff)
+{
+    if (last - first <= cutoff)
+    {
+        sort(first, last);
+        return;
+    }
+    int pivot = first[(last - first) / 2];
+    int *mid1 = partition(first, last, [pivot](int x) { return x < pivot; });
+    int *mid2 = partition(mid1, last, [pivot](int x) { return !(pivot < x); });
+    task_group g;
+    pool.spawn(g, [&pool, first, mid1, cutoff] { quicksort_parallel(pool, first, mid1, cutoff); });
+    quicksort_parallel(pool, mid2, last, cutoff);
+    pool.sync(g);
+}
+
+template <class F>
+double seconds_for(F f)
+{
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    // The deque on its own: the owner sees LIFO order, a thief sees FIFO order.
+    work_deque<char> d;
+    for (char c = 'a'; c <= 'e'; c++)
+        d.push(c);
+    char c;
+    d.steal(c);
+    cout << "steal() takes the oldest: " << c << "\n";
+    cout << "pop() takes the newest:   ";
+    while (d.pop(c))
+        cout << c << " ";
+    cout << "\n\n";
+
+    const int fib_n = 38, fib_cutoff = 18;
+    const size_t sort_n = 4u << 20;
+    vector<int> input(sort_n);
+    unsigned seed = 12345;
+    for (int &x : input)
+    {
+        seed = seed * 1103515245u + 12345u;
+        x = int(seed >> 1);
+    }
+
+    long fib_expected = 0;
+    double fib_base = seconds_for([&] { fib_expected = fib_serial(fib_n); });
+    vector<int> sorted = input;
+    double sort_base = seconds_for([&] { sort(sorted.begin(), sorted.end()); });
+    cout << "serial: fib(" << fib_n << ") " << fib_base << " s, sort " << sort_n << " ints " << sort_base << " s\n";
+
+    unsigned max_threads = argc > 1 ? unsigned(atoi(argv[1])) : thread::hardware_concurrency();
+    max_threads = max(1u, max_threads);
+    vector<unsigned> counts;
+    for (unsigned t = 1; t < max_threads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(max_threads);
+
+    cout << "threads  fib s    speedup  sort s   speedup\n";
+    for (unsigned threads : counts)
+    {
+        thread_pool pool(threads);
+        long fib_result = 0;
+        double fib_time = seconds_for([&] { fib_result = fib_parallel(pool, fib_n, fib_cutoff); });
+
+        vector<int> data = input;
+        double sort_time = seconds_for([&] { quicksort_parallel(pool, data.data(), data.data() + data.size(), 16384); });
+
+        bool ok = fib_result == fib_expected && data == sorted;
+        cout << threads << "\t " << fib_time << "  " << fib_base / fib_time << "x   " << sort_time << "  "
+             << sort_base / sort_time << "x" << (ok ? "" : "  (WRONG RESULT)") << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,463 @@
+/*
+10. The timer of 3.cpp prints one number when it is destroyed. To see where the time goes
+across several threads it is more useful to keep every scope as an event on a timeline.
+This program turns the timer into a tracer whose output can be opened in the Perfetto UI
+(ui.perfetto.dev, which loads the file locally) or in chrome://tracing.
+
+A trace_scope object records its start time in the constructor. Its destructor writes
+one "complete" event (name, thread, start, duration) into a ring buffer that belongs to
+the current thread. Only that thread writes the ring and only the flusher reads it, so
+the ring needs no lock: the writer advances head, the reader advances tail, and each
+only reads the other's counter.
+
+A background thread, the flusher, empties all the rings every few milliseconds and
+writes the events to a file in Chrome's trace-event JSON format.
+  - tracer::enable() and tracer::disable() switch recording on and off at run time. A
+    scope created while tracing is disabled costs one load of a flag.
+  - Memory is bounded: every thread gets a ring of a fixed size, and no more rings are
+    created once the memory budget is used up. When a thread exits, its ring goes back
+    to the tracer; once the flusher has emptied it, the next new thread reuses it, so
+    short-lived threads do not use up the budget.
+  - An event that does not fit (the ring is full because the flusher is behind, or the
+    thread has no ring) is dropped and counted in tracer::dropped().
+  - The tracer is started once: start() sets the ring size and the budget, and returns
+    false after stop(), because threads may still hold rings of the old size.
+Scope names must be string literals (or otherwise live until the tracer stops), because
+only the pointer is stored. They are escaped for JSON when written.
+
+main() measures the cost of a scope with tracing on and off, then traces a sorting
+workload in four threads and writes trace.json (or the file named on the command line).
+
+Compile and run with:
+    g++ -std=c++17 -O2 -pthread 10.cpp -o tracer
+    ./tracer [trace.json]
+*/
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// One finished scope.
+struct trace_event
+{
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+// Single-writer, single-reader ring of events.
+class event_ring
+{
+    trace_event *events;
+    size_t mask;
+    alignas(64) atomic<uint64_t> head; // next slot to write, advanced by the owning thread
+    alignas(64) atomic<uint64_t> tail; // next slot to read, advanced by the flusher
+
+public:
+    // A ring passes from thread to thread: IN_USE while its thread lives, RETIRED when the
+    // thread has exited (the flusher still has to empty it), FREE once it is empty.
+    enum ring_state
+    {
+        IN_USE,
+        RETIRED,
+        FREE
+    };
+    atomic<int> state;
+    atomic<unsigned> tid; // the owning thread's id in the trace; changes when the ring is reused
+
+    event_ring(size_t capacity, unsigned id) : events(new trace_event[capacity]), mask(capacity - 1)
+    {
+        head.store(0, memory_order_relaxed);
+        tail.store(0, memory_order_relaxed);
+        state.store(IN_USE, memory_order_relaxed);
+        tid.store(id, memory_order_relaxed);
+    }
+    ~event_ring() { delete[] events; }
+    event_ring(const event_ring &) = delete;
+    event_ring &operator=(const event_ring &) = delete;
+
+    bool push(const trace_event &e)
+    {
+        uint64_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) > mask)
+            return false; // full
+        events[h & mask] = e;
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    // Hand every event written so far to f, then free their slots.
+    template <class F>
+    size_t drain(F f)
+    {
+        uint64_t t = tail.load(memory_order_relaxed);
+        uint64_t h = head.load(memory_order_acquire);
+        for (uint64_t i = t; i != h; i++)
+            f(events[i & mask]);
+        tail.store(h, memory_order_release);
+        return size_t(h - t);
+    }
+};
+
+// Declare the tracer: per-thread rings, a flusher thread and the output file.
+class tracer
+{
+    static constexpr unsigned MAX_THREADS = 256;
+
+    atomic<bool> enabled;
+    atomic<bool> running;
+    atomic<event_ring *> rings[MAX_THREADS];
+    atomic<unsigned> ring_count; // rings created, all published in rings[] or about to be
+    atomic<unsigned> free_rings; // rings in the FREE state, waiting for a new thread
+    atomic<unsigned> thread_ids; // threads that have had a ring
+    atomic<uint64_t> drops;
+    atomic<uint64_t> written;
+    size_t ring_capacity;
+    size_t budget_rings; // how many rings the memory budget allows
+    FILE *out;
+    bool first_event;
+    bool started;
+    thread flusher;
+    chrono::steady_clock::time_point epoch;
+
+    tracer();
+    event_ring *ring_for_this_thread();
+    event_ring *claim_ring();
+    void flush_once();
+    void write_event(unsigned tid, const trace_event &e);
+
+public:
+    static tracer &instance();
+
+    // Start writing to path. budget_bytes bounds the memory used by all rings together.
+    // Only once per program: returns false if the tracer has been started before.
+    bool start(const char *path, size_t budget_bytes = 16 << 20, size_t events_per_thread = 1 << 16);
+    void stop(); // flushes everything and closes the file
+
+    void enable() { enabled.store(true, memory_order_relaxed); }
+    void disable() { enabled.store(false, memory_order_relaxed); }
+    bool is_enabled() const { return enabled.load(memory_order_relaxed); }
+    uint64_t dropped() const { return drops.load(memory_order_relaxed); }
+    uint64_t events_written() const { return written.load(memory_order_relaxed); }
+
+    uint64_t now_ns() const
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+    void record(const char *name, uint64_t start_ns, uint64_t end_ns);
+};
+
+tracer::tracer()
+{
+    enabled.store(false);
+    running.store(false);
+    for (auto &r : rings)
+        r.store(nullptr);
+    ring_count.store(0);
+    free_rings.store(0);
+    thread_ids.store(0);
+    drops.store(0);
+    written.store(0);
+    ring_capacity = 0;
+    budget_rings = 0;
+    out = nullptr;
+    first_event = true;
+    started = false;
+    epoch = chrono::steady_clock::now();
+}
+
+tracer &tracer::instance()
+{
+    static tracer *t = new tracer; // never destroyed: threads may still hold their rings
+    return *t;
+}
+
+// Declare the link between a thread and its ring. The destructor runs when the thread
+// exits and hands the ring back; the flusher frees it once it has written the last events.
+struct ring_owner
+{
+    event_ring *ring = nullptr;
+    bool refused = false; // no ring was available the last time this thread asked
+
+    ~ring_owner()
+    {
+        if (ring)
+            ring->state.store(event_ring::RETIRED, memory_order_release);
+    }
+};
+
+// A free ring left by a thread that has exited, or else a new one if the budget allows.
+event_ring *tracer::claim_ring()
+{
+    if (free_rings.load(memory_order_relaxed))
+    {
+        unsigned n = min(ring_count.load(memory_order_acquire), MAX_THREADS);
+        for (unsigned i = 0; i < n; i++)
+        {
+            event_ring *r = rings[i].load(memory_order_acquire);
+            int expected = event_ring::FREE;
+            if (r && r->state.compare_exchange_strong(expected, event_ring::IN_USE, memory_order_acq_rel))
+            {
+                free_rings.fetch_sub(1, memory_order_relaxed);
+                r->tid.store(thread_ids.fetch_add(1) + 1, memory_order_relaxed);
+                return r;
+            }
+        }
+    }
+    unsigned id = ring_count.load();
+    do
+    {
+        if (id >= budget_rings || id >= MAX_THREADS)
+            return nullptr;
+    } while (!ring_count.compare_exchange_weak(id, id + 1));
+    event_ring *r = new event_ring(ring_capacity, thread_ids.fetch_add(1) + 1);
+    rings[id].store(r, memory_order_release);
+    return r;
+}
+
+// The calling thread's ring, claimed on its first event. A thread that was refused one
+// asks again only when a ring has been freed, so being over budget stays cheap.
+event_ring *tracer::ring_for_this_thread()
+{
+    thread_local ring_owner mine;
+    if (mine.ring || (mine.refused && !free_rings.load(memory_order_relaxed)))
+        return mine.ring;
+    mine.ring = claim_ring();
+    mine.refused = !mine.ring; // over budget: this thread's events are dropped for now
+    return mine.ring;
+}
+
+void tracer::record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    event_ring *r = ring_for_this_thread();
+    if (!r || !r->push(trace_event{name, start_ns, end_ns - start_ns}))
+        drops.fetch_add(1, memory_order_relaxed);
+}
+
+bool tracer::start(const char *path, size_t budget_bytes, size_t events_per_thread)
+{
+    if (started)
+        return false;
+    out = fopen(path, "w");
+    if (!out)
+        return false;
+    started = true;
+    size_t capacity = 1;
+    while (capacity < events_per_thread)
+        capacity *= 2;
+    ring_capacity = capacity;
+    budget_rings = budget_bytes / (capacity * sizeof(trace_event));
+    first_event = true;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    running.store(true);
+    enable();
+    flusher = thread([this] {
+        while (running.load(memory_order_acquire))
+        {
+            flush_once();
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+    });
+    return true;
+}
+
+void tracer::stop()
+{
+    if (!running.load())
+        return;
+    disable();
+    running.store(false, memory_order_release);
+    flusher.join();
+    flush_once(); // whatever arrived after the flusher's last pass
+
+    // Name each thread in the viewer.
+    for (unsigned id = 1; id <= thread_ids.load(); id++)
+    {
+        fprintf(out, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"thread %u\"}}",
+                first_event ? "" : ",\n", id, id);
+        first_event = false;
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    out = nullptr;
+}
+
+void tracer::flush_once()
+{
+    unsigned n = min(ring_count.load(memory_order_acquire), MAX_THREADS);
+    for (unsigned i = 0; i < n; i++)
+    {
+        event_ring *r = rings[i].load(memory_order_acquire);
+        if (!r) // a ring that has not been published yet
+            continue;
+        // Read the state first: if the thread had exited by then, this drain gets its
+        // last events, and the ring can be reused.
+        int state = r->state.load(memory_order_acquire);
+        written.fetch_add(r->drain([&](const trace_event &e) { write_event(r->tid.load(memory_order_relaxed), e); }),
+                          memory_order_relaxed);
+        if (state == event_ring::RETIRED)
+        {
+            free_rings.fetch_add(1, memory_order_relaxed);
+            r->state.store(event_ring::FREE, memory_order_release);
+        }
+    }
+    fflush(out);
+}
+
+void tracer::write_event(unsigned tid, const trace_event &e)
+{
+    // Names are copied through a small escape so quotes and control characters cannot
+    // break the JSON.
+    char name[128];
+    size_t j = 0;
+    for (const char *c = e.name; *c && j + 7 < sizeof(name); c++)
+    {
+        unsigned char u = *c;
+        if (u < 0x20)
+            j += snprintf(name + j, sizeof(name) - j, "\\u%04x", u);
+        else
+        {
+            if (u == '"' || u == '\\')
+                name[j++] = '\\';
+            name[j++] = *c;
+        }
+    }
+    name[j] = '\0';
+    // Timestamps are in microseconds; three decimals keep nanosecond precision.
+    fprintf(out, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+            first_event ? "" : ",\n", tid, name, e.start_ns / 1e3, e.duration_ns / 1e3);
+    first_event = false;
+}
+
+// Declare a traced scope: the timer of 3.cpp, but writing an event instead of printing.
+class trace_scope
+{
+    const char *name;
+    uint64_t start;
+
+public:
+    explicit trace_scope(const char *scope_name)
+    {
+        tracer &t = tracer::instance();
+        name = t.is_enabled() ? scope_name : nullptr;
+        if (name)
+            start = t.now_ns();
+    }
+    ~trace_scope()
+    {
+        if (name)
+        {
+            tracer &t = tracer::instance();
+            t.record(name, start, t.now_ns());
+        }
+    }
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+};
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// CPU time of the calling thread only, so the flusher's work is not counted.
+double thread_cpu_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double scope_cost_ns(size_t reps)
+{
+    double t0 = thread_cpu_ns();
+    for (size_t i = 0; i < reps; i++)
+    {
+        trace_scope s("empty");
+        asm volatile("" ::: "memory");
+    }
+    return (thread_cpu_ns() - t0) / reps;
+}
+
+long sort_job(unsigned seed, size_t n)
+{
+    trace_scope job("sort_job");
+    vector<unsigned> v(n);
+    {
+        trace_scope f("fill");
+        for (auto &x : v)
+            x = seed = seed * 1664525u + 1013904223u;
+    }
+    {
+        trace_scope s("sort");
+        sort(v.begin(), v.end());
+    }
+    trace_scope c("checksum");
+    long sum = 0;
+    for (unsigned x : v)
+        sum += x >> 24;
+    return sum;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "trace.json";
+    tracer &t = tracer::instance();
+    if (!t.start(path))
+    {
+        cout << "Cannot open " << path << "\n";
+        return 1;
+    }
+
+    // 50000 scopes fit in one 64K-event ring, so the enabled cost is measured without drops.
+    t.disable();
+    double off = scope_cost_ns(1000000);
+    t.enable();
+    scope_cost_ns(50000); // creates this thread's ring and touches its pages
+    this_thread::sleep_for(chrono::milliseconds(20));
+    double on = scope_cost_ns(50000);
+    cout << "Cost per scope: tracing disabled " << off << " ns, enabled " << on << " ns\n";
+
+    // 1M scopes in a tight loop outrun the flusher, so many are dropped: that is what the
+    // drop counter is for.
+    this_thread::sleep_for(chrono::milliseconds(20));
+    scope_cost_ns(1000000);
+    cout << "  dropped " << t.dropped() << " of 1000000 events from a tight loop\n";
+    uint64_t drops_before = t.dropped();
+
+    long checksum = 0;
+    vector<thread> workers;
+    vector<long> sums(4);
+    for (unsigned w = 0; w < 4; w++)
+        workers.emplace_back([w, &sums] {
+            trace_scope worker("worker");
+            for (unsigned i = 0; i < 50; i++)
+                sums[w] += sort_job(w * 1000 + i, 50000);
+        });
+    for (auto &w : workers)
+        w.join();
+    for (long s : sums)
+        checksum += s;
+    cout << "Workload: 4 threads x 50 jobs, dropped " << t.dropped() - drops_before << " events\n";
+
+    // Many more short-lived threads than the budget has rings (10): each reuses the ring of
+    // one that has exited, once the flusher has emptied it.
+    drops_before = t.dropped();
+    for (unsigned i = 0; i < 100; i++)
+    {
+        thread([i, &checksum] { checksum += sort_job(i, 1000); }).join();
+        this_thread::sleep_for(chrono::milliseconds(6)); // one pass of the flusher
+    }
+    cout << "100 short-lived threads, dropped " << t.dropped() - drops_before << " events\n";
+    t.stop();
+
+    cout << "Wrote " << t.events_written() << " events to " << path << " (checksum " << checksum << ")\n";
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*
+11. The timer of 3.cpp says how long a block took, but not why. Two loops can take the
+same time for different reasons: one executes many instructions per clock cycle and is
+limited by arithmetic, the other waits for memory most of the time. The CPU counts
+events that tell them apart, and Linux exposes those counters through the
+perf_event_open() system call.
+
+This program extends the timer with those counters. A perf_timer is still created at
+the start of a block and prints its results in its destructor, but it now reports,
+besides the elapsed time:
+    cycles, instructions      and their ratio, instructions per cycle (IPC)
+    cache-misses              last-level cache misses
+    branch-misses             mispredicted branches
+    context-switches          times the thread lost the CPU
+    page-faults               pages the kernel had to map in
+each divided by the number of iterations passed to the constructor.
+
+The counters are opened once per thread, each on its own, so that one missing counter
+does not take the others with it. Inside containers and virtual machines the hardware
+counters are often not available; then only the software counters (context switches and
+page faults) are used, and if perf_event_open() is not allowed at all, those two come
+from getrusage(). Counters that cannot be read are printed as "-".
+
+main() times three loops: a chain of dependent multiplications (compute-bound), a
+random pointer chase through 64 MB (memory-bound) and a sequential sum over the same
+memory (bandwidth-bound).
+
+This program needs Linux. Compile with:
+    g++ -std=c++17 -O2 11.cpp -o perf_timer
+*/
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace std;
+
+enum counter_id
+{
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BRANCH_MISSES,
+    CONTEXT_SWITCHES,
+    PAGE_FAULTS,
+    NUM_COUNTERS
+};
+
+const char *counter_names[NUM_COUNTERS] = {"cycles", "instructions", "cache-misses",
+                                           "branch-misses", "context-switches", "page-faults"};
+
+// Declare the counters of the calling thread.
+class perf_counters
+{
+    int fds[NUM_COUNTERS];
+    bool use_rusage; // perf_event_open() refused: software counts come from getrusage()
+
+    static int open_counter(uint32_t type, uint64_t config);
+
+public:
+    perf_counters();
+    ~perf_counters();
+    perf_counters(const perf_counters &) = delete;
+    perf_counters &operator=(const perf_counters &) = delete;
+
+    bool available(counter_id c) const { return fds[c] >= 0 || (use_rusage && c >= CONTEXT_SWITCHES); }
+    void read_all(uint64_t values[NUM_COUNTERS]) const;
+    const char *source() const;
+
+    static perf_counters &this_thread_counters();
+};
+
+int perf_counters::open_counter(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    // Hardware counts are limited to user code, which the default perf_event_paranoid
+    // setting allows; software events such as page faults happen in the kernel.
+    attr.exclude_kernel = type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv = 1;
+    // Ask for the enabled and running times, to scale counts if the kernel multiplexes.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid 0, cpu -1: this thread, on whatever CPU it runs.
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+perf_counters::perf_counters()
+{
+    fds[CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[CACHE_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[CONTEXT_SWITCHES] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+    fds[PAGE_FAULTS] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    use_rusage = fds[CONTEXT_SWITCHES] < 0 && fds[PAGE_FAULTS] < 0;
+}
+
+perf_counters::~perf_counters()
+{
+    for (int fd : fds)
+        if (fd >= 0)
+            close(fd);
+}
+
+// Current totals; counters that are not available read as 0.
+void perf_counters::read_all(uint64_t values[NUM_COUNTERS]) const
+{
+    for (int c = 0; c < NUM_COUNTERS; c++)
+    {
+        values[c] = 0;
+        uint64_t buf[3]; // value, time enabled, time running
+        if (fds[c] >= 0 && ::read(fds[c], buf, sizeof(buf)) == sizeof(buf))
+            values[c] = buf[2] && buf[2] < buf[1] ? uint64_t(double(buf[0]) * buf[1] / buf[2]) : buf[0];
+    }
+    if (use_rusage)
+    {
+        rusage ru;
+        getrusage(RUSAGE_THREAD, &ru);
+        values[CONTEXT_SWITCHES] = ru.ru_nvcsw + ru.ru_nivcsw;
+        values[PAGE_FAULTS] = ru.ru_minflt + ru.ru_majflt;
+    }
+}
+
+const char *perf_counters::source() const
+{
+    if (fds[CYCLES] >= 0 || fds[INSTRUCTIONS] >= 0)
+        return "hardware and software perf events";
+    if (!use_rusage)
+        return "software perf events only (no hardware counters here)";
+    return "getrusage() only (perf_event_open() not permitted)";
+}
+
+perf_counters &perf_counters::this_thread_counters()
+{
+    thread_local perf_counters counters; // opened on first use in each thread
+    return counters;
+}
+
+// Declare a timer that also reads the performance counters around its block.
+class perf_timer
+{
+    const char *name;
+    double iterations;
+    uint64_t before[NUM_COUNTERS];
+    chrono::steady_clock::time_point start;
+
+public:
+    perf_timer(const char *block_name, uint64_t iters = 1)
+    {
+        name = block_name;
+        iterations = double(iters ? iters : 1);
+        perf_counters::this_thread_counters().read_all(before);
+        start = chrono::steady_clock::now(); // The constructor reads the counters and the clock...
+    }
+    ~perf_timer()
+    {
+        auto end = chrono::steady_clock::now(); // ...and the destructor reads them again.
+        uint64_t after[NUM_COUNTERS];
+        perf_counters &pc = perf_counters::this_thread_counters();
+        pc.read_all(after);
+
+        char line[256];
+        int n = snprintf(line, sizeof(line), "%-14s %9.2f ns/iter", name,
+                         chrono::duration<double, nano>(end - start).count() / iterations);
+        for (int c = 0; c < NUM_COUNTERS; c++)
+        {
+            if (pc.available(counter_id(c)))
+                n += snprintf(line + n, sizeof(line) - n, " %10.4f", (after[c] - before[c]) / iterations);
+            else
+                n += snprintf(line + n, sizeof(line) - n, " %10s", "-");
+        }
+        if (pc.available(CYCLES) && pc.available(INSTRUCTIONS) && after[CYCLES] > before[CYCLES])
+            snprintf(line + n, sizeof(line) - n, "   IPC %.2f",
+                     double(after[INSTRUCTIONS] - before[INSTRUCTIONS]) / (after[CYCLES] - before[CYCLES]));
+        cout << line << "\n";
+    }
+    perf_timer(const perf_timer &) = delete;
+    perf_timer &operator=(const perf_timer &) = delete;
+
+    static void print_header()
+    {
+        printf("%-14s %18s", "per iteration", "time");
+        for (const char *c : counter_names)
+            printf(" %10.10s", c);
+        printf("\n");
+        fflush(stdout);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+int main()
+{
+    cout << "Counters: " << perf_counters::this_thread_counters().source() << "\n\n";
+    const size_t n = (64 << 20) / sizeof(uint32_t); // 64 MB of indices
+    const size_t steps = 20000000;
+    vector<uint32_t> next;
+    double checksum = 0;
+
+    perf_timer::print_header();
+    {
+        perf_timer t("first touch", n); // every page of next is mapped in here
+        next.resize(n);
+        for (size_t i = 0; i < n; i++)
+            next[i] = uint32_t(i);
+    }
+
+    // Sattolo's shuffle makes one cycle through all n slots, so the chase visits them all.
+    uint64_t seed = 88172645463325252ull;
+    for (size_t i = n - 1; i > 0; i--)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        size_t j = seed % i;
+        swap(next[i], next[j]);
+    }
+
+    {
+        perf_timer t("compute", steps);
+        double x = 1.0;
+        for (size_t i = 0; i < steps; i++)
+            x = x * 1.0000001 + 1e-9; // each step waits for the previous one
+        checksum += x;
+    }
+    {
+        perf_timer t("pointer chase", steps);
+        uint32_t p = 0;
+        for (size_t i = 0; i < steps; i++)
+            p = next[p]; // each load depends on the previous one, and misses the cache
+        checksum += p;
+    }
+    {
+        perf_timer t("sequential", n);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += next[i];
+        checksum += double(sum);
+    }
+
+    cout << "\nLow IPC with many cache misses per iteration means memory-bound; high IPC with\n"
+            "few misses means compute-bound. (checksum "
+         << checksum << ")\n";
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+4. Every push() and pop() in the stack of 1.cpp checks the bounds on its own, and when the
+check fails it prints a message from inside the function. That is fine for three
+characters, but a tokenizer pushes and pops whole runs of characters at a time.
+
+Here is a version of the stack class with two bulk operations:
+    push_n(const char *src, n)  pushes n characters with one capacity check and one memcpy
+    pop_n(char *out, n)         pops the top n characters with one check and one memcpy
+pop_n() writes the characters in the order they were pushed, so pop_n() after push_n()
+gives back exactly the same bytes. A bulk operation either transfers all n characters
+or none of them.
+
+Errors are returned as a status value instead of being printed, so the caller decides
+what to do about them. The constructor takes the capacity, and the buffer is allocated
+in the constructor and freed in the destructor.
+
+main() times per-element push/pop against push_n/pop_n for 16 B, 4 KB and 1 MB batches.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 4.cpp -o bulk_stack
+*/
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Result of a stack operation.
+enum stack_status
+{
+    STACK_OK,
+    STACK_FULL,  // not enough room for the push
+    STACK_EMPTY  // not enough characters for the pop
+};
+
+const char *status_name(stack_status st)
+{
+    switch (st)
+    {
+    case STACK_OK:
+        return "ok";
+    case STACK_FULL:
+        return "stack is full";
+    case STACK_EMPTY:
+        return "stack is empty";
+    }
+    return "unknown";
+}
+
+// Declare a stack class for characters with bulk operations.
+class stack
+{
+    char *stck;  // holds the stack
+    size_t size; // capacity of stck
+    size_t tos;  // index of top of stack
+
+public:
+    explicit stack(size_t capacity)
+    {
+        stck = new char[capacity];
+        size = capacity;
+        tos = 0;
+    } // constructor
+
+    ~stack()
+    {
+        delete[] stck;
+    } // destructor
+
+    stack(const stack &) = delete;
+    stack &operator=(const stack &) = delete;
+
+    stack_status push(char ch)
+    {
+        if (tos == size)
+            return STACK_FULL;
+        stck[tos] = ch;
+        tos++;
+        return STACK_OK;
+    } // push character on stack
+
+    stack_status pop(char &ch)
+    {
+        if (tos == 0)
+            return STACK_EMPTY;
+        tos--;
+        ch = stck[tos];
+        return STACK_OK;
+    } // pop character from stack
+
+    stack_status push_n(const char *src, size_t n)
+    {
+        if (n > size - tos)
+            return STACK_FULL;
+        memcpy(stck + tos, src, n);
+        tos += n;
+        return STACK_OK;
+    } // push n characters, src[n - 1] ends up on top
+
+    stack_status pop_n(char *out, size_t n)
+    {
+        if (n > tos)
+            return STACK_EMPTY;
+        tos -= n;
+        memcpy(out, stck + tos, n);
+        return STACK_OK;
+    } // pop the top n characters, in the order they were pushed
+
+    size_t count() const { return tos; }
+    size_t capacity() const { return size; }
+};
+
+// Push and pop batch characters per round, rounds times, one character at a time.
+// Returns nanoseconds per byte moved.
+double time_per_element(stack &s, const char *src, char *out, size_t batch, size_t rounds)
+{
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < batch; i++)
+            s.push(src[i]);
+        for (size_t i = batch; i > 0; i--)
+            s.pop(out[i - 1]);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / (2.0 * batch * rounds);
+}
+
+// The same work with one push_n() and one pop_n() per round.
+double time_bulk(stack &s, const char *src, char *out, size_t batch, size_t rounds)
+{
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        s.push_n(src, batch);
+        s.pop_n(out, batch);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / (2.0 * batch * rounds);
+}
+
+int main()
+{
+    stack s(10);
+    char word[6];
+
+    // A bulk push that fits, and one that does not.
+    cout << "push_n(\"hello\"): " << status_name(s.push_n("hello", 5)) << "\n";
+    cout << "push_n(\"world!\"): " << status_name(s.push_n("world!", 6)) << " (count is still " << s.count()
+         << ")\n";
+
+    s.pop_n(word, 5);
+    word[5] = '\0';
+    cout << "pop_n(5) gives back: " << word << "\n";
+
+    char ch;
+    cout << "pop() on the empty stack: " << status_name(s.pop(ch)) << "\n\n";
+
+    cout << "Per-element vs bulk transfer (ns per byte):\n";
+    const size_t batches[] = {16, 4 * 1024, 1024 * 1024};
+    const size_t total_bytes = 256u << 20; // same total work for every batch size
+    for (size_t batch : batches)
+    {
+        vector<char> src(batch), out(batch);
+        for (size_t i = 0; i < batch; i++)
+            src[i] = static_cast<char>('a' + i % 26);
+        stack big(batch);
+        size_t rounds = total_bytes / batch;
+
+        double single = time_per_element(big, src.data(), out.data(), batch, rounds);
+        double bulk = time_bulk(big, src.data(), out.data(), batch, rounds);
+        bool same = memcmp(src.data(), out.data(), batch) == 0;
+
+        cout << "  batch " << batch << " B: per-element " << single << ", bulk " << bulk << ", speedup "
+             << single / bulk << "x" << (same ? "" : " (MISMATCH)") << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,420 @@
+/*
+5. A stack of characters, like the one in 1.cpp, is the classic tool for reading arithmetic
+formulas. Dijkstra's shunting-yard algorithm keeps one stack of operators and turns an
+infix formula such as  3*x + (y - 1)/2  into postfix order:  3 x * y 1 - 2 / +
+Postfix is then evaluated with a second stack, this time of values.
+
+This program uses that operator stack/value stack pair to build a small expression engine.
+The formula class parses a formula with variables once, in its constructor, and stores
+it as compact postfix bytecode. The constructor also works out how deep the value stack
+can get, so evaluate() needs no allocation: it runs the bytecode over a value stack in
+a local array (only a formula nested deeper than 64 values allocates one, once per
+call). evaluate_batch() runs the same formula over many sets of variable values in one
+call. Both are const and keep no state in the object, so several threads may evaluate
+the same formula at once.
+
+Supported: numbers, variables, + - * / ^ (power, right associative), unary minus and
+parentheses. A formula that cannot be parsed throws invalid_argument.
+
+main() compares parsing the formula for every evaluation against compiling it once and
+evaluating it many times.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 5.cpp -o formula
+*/
+#include <iostream>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Declare a stack class. The parser uses one for operators.
+template <class T>
+class stack
+{
+    vector<T> stck; // holds the stack
+public:
+    void push(const T &x) { stck.push_back(x); }
+    T pop()
+    {
+        T x = stck.back();
+        stck.pop_back();
+        return x;
+    }
+    const T &top() const { return stck.back(); }
+    bool empty() const { return stck.empty(); }
+};
+
+// One bytecode instruction: an opcode and, for pushes, an index into the constants or variables.
+struct instruction
+{
+    enum opcode : uint8_t
+    {
+        PUSH_CONST,
+        PUSH_VAR,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        POW,
+        NEG
+    };
+    opcode op;
+    uint32_t arg;
+};
+
+// A formula compiled to postfix bytecode.
+class formula
+{
+    vector<instruction> code;
+    vector<double> constants;
+    vector<string> names; // variable names, in the order evaluate() expects their values
+    size_t max_depth;     // the deepest the value stack gets
+
+    // Value stacks up to this deep live in a local array of evaluate().
+    static const size_t LOCAL_DEPTH = 64;
+
+    void compile(const string &text);
+    void emit_operator(char op);
+    double run(const double *vars, double *stck) const;
+
+public:
+    formula(const string &text, const vector<string> &variables); // constructor: parse and compile
+    double evaluate(const double *vars) const;
+    void evaluate_batch(const double *vars, size_t count, double *out) const;
+    size_t variable_count() const { return names.size(); }
+    size_t code_size() const { return code.size(); }
+    string disassemble() const;
+};
+
+// Binding power of each operator; 'u' is unary minus.
+static int precedence(char op)
+{
+    switch (op)
+    {
+    case '+':
+    case '-':
+        return 1;
+    case '*':
+    case '/':
+        return 2;
+    case 'u':
+        return 3;
+    case '^':
+        return 4;
+    }
+    return 0;
+}
+
+static bool right_associative(char op)
+{
+    return op == '^' || op == 'u';
+}
+
+formula::formula(const string &text, const vector<string> &variables) : names(variables), max_depth(0)
+{
+    compile(text);
+
+    // Simulate the stack once to find how deep it can get.
+    size_t depth = 0;
+    for (const instruction &in : code)
+    {
+        if (in.op == instruction::PUSH_CONST || in.op == instruction::PUSH_VAR)
+            depth++;
+        else if (in.op != instruction::NEG)
+            depth--;
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+}
+
+void formula::emit_operator(char op)
+{
+    instruction in;
+    in.arg = 0;
+    switch (op)
+    {
+    case '+':
+        in.op = instruction::ADD;
+        break;
+    case '-':
+        in.op = instruction::SUB;
+        break;
+    case '*':
+        in.op = instruction::MUL;
+        break;
+    case '/':
+        in.op = instruction::DIV;
+        break;
+    case '^':
+        in.op = instruction::POW;
+        break;
+    default:
+        in.op = instruction::NEG;
+        break;
+    }
+    code.push_back(in);
+}
+
+// Shunting-yard: operands go straight to the output, operators wait on ops until
+// an operator of lower precedence (or a closing parenthesis) arrives.
+void formula::compile(const string &text)
+{
+    stack<char> ops;
+    bool expect_operand = true; // true at the start, after an operator and after '('
+    size_t i = 0;
+
+    while (i < text.size())
+    {
+        char c = text[i];
+        if (isspace(static_cast<unsigned char>(c)))
+        {
+            i++;
+        }
+        else if (isdigit(static_cast<unsigned char>(c)) || c == '.')
+        {
+            if (!expect_operand)
+                throw invalid_argument("missing operator before number at position " + to_string(i));
+            char *end;
+            double v = strtod(text.c_str() + i, &end);
+            if (end == text.c_str() + i) // a lone '.' is not a number
+                throw invalid_argument("bad number at position " + to_string(i));
+            constants.push_back(v);
+            code.push_back({instruction::PUSH_CONST, uint32_t(constants.size() - 1)});
+            i = end - text.c_str();
+            expect_operand = false;
+        }
+        else if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+        {
+            if (!expect_operand)
+                throw invalid_argument("missing operator before variable at position " + to_string(i));
+            size_t start = i;
+            while (i < text.size() && (isalnum(static_cast<unsigned char>(text[i])) || text[i] == '_'))
+                i++;
+            string name = text.substr(start, i - start);
+            size_t slot = 0;
+            while (slot < names.size() && names[slot] != name)
+                slot++;
+            if (slot == names.size())
+                throw invalid_argument("unknown variable '" + name + "'");
+            code.push_back({instruction::PUSH_VAR, uint32_t(slot)});
+            expect_operand = false;
+        }
+        else if (c == '(')
+        {
+            if (!expect_operand)
+                throw invalid_argument("missing operator before '(' at position " + to_string(i));
+            ops.push(c);
+            i++;
+        }
+        else if (c == ')')
+        {
+            if (expect_operand)
+                throw invalid_argument("missing operand before ')' at position " + to_string(i));
+            while (!ops.empty() && ops.top() != '(')
+                emit_operator(ops.pop());
+            if (ops.empty())
+                throw invalid_argument("unbalanced ')' at position " + to_string(i));
+            ops.pop(); // discard '('
+            i++;
+        }
+        else if (precedence(c) > 0)
+        {
+            char op = c;
+            if (expect_operand)
+            {
+                if (c != '-')
+                    throw invalid_argument(string("missing operand before '") + c + "' at position " + to_string(i));
+                op = 'u';
+            }
+            // A prefix operator has no left operand yet, so it never pops anything.
+            while (op != 'u' && !ops.empty() && ops.top() != '(' &&
+                   (precedence(ops.top()) > precedence(op) ||
+                    (precedence(ops.top()) == precedence(op) && !right_associative(op))))
+                emit_operator(ops.pop());
+            ops.push(op);
+            expect_operand = true;
+            i++;
+        }
+        else
+        {
+            throw invalid_argument(string("unexpected character '") + c + "' at position " + to_string(i));
+        }
+    }
+    if (expect_operand)
+        throw invalid_argument("formula ends without an operand");
+    while (!ops.empty())
+    {
+        if (ops.top() == '(')
+            throw invalid_argument("unbalanced '('");
+        emit_operator(ops.pop());
+    }
+}
+
+// Run the bytecode with the given variable values (one per name, in order) over stck,
+// which has room for max_depth values.
+double formula::run(const double *vars, double *stck) const
+{
+    size_t tos = 0;
+    for (const instruction &in : code)
+    {
+        switch (in.op)
+        {
+        case instruction::PUSH_CONST:
+            stck[tos++] = constants[in.arg];
+            break;
+        case instruction::PUSH_VAR:
+            stck[tos++] = vars[in.arg];
+            break;
+        case instruction::ADD:
+            tos--;
+            stck[tos - 1] += stck[tos];
+            break;
+        case instruction::SUB:
+            tos--;
+            stck[tos - 1] -= stck[tos];
+            break;
+        case instruction::MUL:
+            tos--;
+            stck[tos - 1] *= stck[tos];
+            break;
+        case instruction::DIV:
+            tos--;
+            stck[tos - 1] /= stck[tos];
+            break;
+        case instruction::POW:
+            tos--;
+            stck[tos - 1] = pow(stck[tos - 1], stck[tos]);
+            break;
+        case instruction::NEG:
+            stck[tos - 1] = -stck[tos - 1];
+            break;
+        }
+    }
+    return stck[0];
+}
+
+double formula::evaluate(const double *vars) const
+{
+    if (max_depth <= LOCAL_DEPTH)
+    {
+        double stck[LOCAL_DEPTH];
+        return run(vars, stck);
+    }
+    vector<double> stck(max_depth);
+    return run(vars, stck.data());
+}
+
+// Evaluate count bindings stored back to back (variable_count() values each), with one
+// value stack for the whole batch.
+void formula::evaluate_batch(const double *vars, size_t count, double *out) const
+{
+    size_t stride = names.size();
+    double local[LOCAL_DEPTH];
+    vector<double> deep(max_depth > LOCAL_DEPTH ? max_depth : 0);
+    double *stck = max_depth > LOCAL_DEPTH ? deep.data() : local;
+    for (size_t i = 0; i < count; i++)
+        out[i] = run(vars + i * stride, stck);
+}
+
+string formula::disassemble() const
+{
+    string s;
+    for (const instruction &in : code)
+    {
+        switch (in.op)
+        {
+        case instruction::PUSH_CONST:
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%g", constants[in.arg]);
+            s += buf;
+            break;
+        }
+        case instruction::PUSH_VAR:
+            s += names[in.arg];
+            break;
+        case instruction::ADD:
+            s += '+';
+            break;
+        case instruction::SUB:
+            s += '-';
+            break;
+        case instruction::MUL:
+            s += '*';
+            break;
+        case instruction::DIV:
+            s += '/';
+            break;
+        case instruction::POW:
+            s += '^';
+            break;
+        case instruction::NEG:
+            s += "neg";
+            break;
+        }
+        s += ' ';
+    }
+    return s;
+}
+
+int main()
+{
+    const string text = "3*x*x + 2*x*y - (z - 1)/(y + 4) + -x^2";
+    const vector<string> vars = {"x", "y", "z"};
+
+    formula f(text, vars);
+    cout << "Formula:  " << text << "\n";
+    cout << "Postfix:  " << f.disassemble() << "(" << f.code_size() << " instructions)\n";
+    double point[] = {2, 1, 6};
+    cout << "x=2 y=1 z=6 gives " << f.evaluate(point) << "\n";
+
+    try
+    {
+        formula bad("3 * (x + ", vars);
+    }
+    catch (const invalid_argument &e)
+    {
+        cout << "Bad formula rejected: " << e.what() << "\n";
+    }
+
+    // A batch of one million variable bindings.
+    const size_t count = 1000000;
+    vector<double> bindings(count * vars.size());
+    for (size_t i = 0; i < bindings.size(); i++)
+        bindings[i] = double(i % 97) * 0.25 + 1.0;
+    vector<double> out(count);
+
+    auto t0 = chrono::steady_clock::now();
+    double reparsed_sum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        formula each(text, vars); // parse every time
+        reparsed_sum += each.evaluate(&bindings[i * vars.size()]);
+    }
+    auto t1 = chrono::steady_clock::now();
+
+    formula once(text, vars); // compile once...
+    auto t2 = chrono::steady_clock::now();
+    once.evaluate_batch(bindings.data(), count, out.data()); // ...evaluate many
+    auto t3 = chrono::steady_clock::now();
+    double batch_sum = 0;
+    for (double v : out)
+        batch_sum += v;
+
+    double reparse_ns = chrono::duration<double, nano>(t1 - t0).count() / count;
+    double batch_ns = chrono::duration<double, nano>(t3 - t2).count() / count;
+    cout << "\n" << count << " evaluations:\n";
+    cout << "  parse every time:          " << reparse_ns << " ns/eval\n";
+    cout << "  compile once, batch eval:  " << batch_ns << " ns/eval (" << 1e3 / batch_ns
+         << " M evals/s)\n";
+    cout << "  speedup " << reparse_ns / batch_ns << "x, results "
+         << (reparsed_sum == batch_sum ? "match" : "DIFFER") << "\n";
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+6. The strtype class in 2.cpp calls malloc(SIZE) in its constructor for every object, even
+one that will only ever hold an empty string, and set() refuses any string of SIZE (25)
+characters or more.
+
+Here is a version of strtype that uses the small-string optimization. The object is 32
+bytes: a pointer p followed by 24 bytes that are used in one of two ways.
+  - A string of up to 23 characters is stored in those 24 bytes, inside the object
+    itself, and p points at them. No memory is allocated at all. The last byte holds
+    23 minus the length, so for a 23-character string it is 0 and doubles as the '\0'.
+  - A longer string is stored in memory from malloc(), and the 24 bytes hold its length
+    and the capacity of that block.
+set() accepts a string of any length and only allocates when the string does not fit in
+the space the object already has.
+
+Because p can point inside the object, strtype needs its own copy constructor and
+assignment operator; copying the pointer as in Lecture 3 would leave it pointing into
+the wrong object.
+
+main() counts allocations and times constructing and destroying millions of short names
+with this class and with the class from 2.cpp.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 6.cpp -o sso_strtype
+*/
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+using namespace std;
+
+#define SIZE 25
+
+unsigned long allocations = 0; // every malloc() made by either strtype below
+
+void *counted_malloc(size_t n)
+{
+    allocations++;
+    void *p = malloc(n);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    return p;
+}
+
+class strtype
+{
+    static const size_t INLINE_CAP = 23;
+
+    char *p; // points at buf for a short string, at a malloc() block for a long one
+    union
+    {
+        char buf[INLINE_CAP + 1]; // short string; buf[23] holds INLINE_CAP - length
+        struct
+        {
+            size_t len; // length of a long string
+            size_t cap; // characters the malloc() block can hold, not counting '\0'
+        } heap;
+    };
+
+    bool is_inline() const { return p == buf; }
+    void set_length(size_t n);
+    void assign(const char *ptr, size_t n);
+
+public:
+    strtype();                           // constructor
+    strtype(const char *ptr);            // constructor from a C string
+    strtype(const strtype &other);       // copy constructor
+    strtype(strtype &&other) noexcept;   // move constructor
+    ~strtype();                          // destructor
+    strtype &operator=(const strtype &other);
+    strtype &operator=(strtype &&other) noexcept;
+
+    void set(const char *ptr);
+    void show() const;
+    const char *c_str() const { return p; }
+    size_t length() const { return is_inline() ? INLINE_CAP - (unsigned char)buf[INLINE_CAP] : heap.len; }
+    bool stored_inline() const { return is_inline(); }
+};
+
+void strtype::set_length(size_t n)
+{
+    p[n] = '\0';
+    if (is_inline())
+        buf[INLINE_CAP] = char(INLINE_CAP - n);
+    else
+        heap.len = n;
+}
+
+// Store the n characters at ptr, reusing the current storage when they fit.
+void strtype::assign(const char *ptr, size_t n)
+{
+    size_t room = is_inline() ? INLINE_CAP : heap.cap;
+    if (n > room)
+    {
+        char *fresh = (char *)counted_malloc(n + 1);
+        if (!is_inline())
+            free(p);
+        p = fresh;
+        heap.cap = n;
+    }
+    memmove(p, ptr, n); // memmove, since ptr may point into this string
+    set_length(n);
+}
+
+// Initialize an empty string object. Nothing is allocated.
+strtype::strtype()
+{
+    p = buf;
+    set_length(0);
+}
+
+strtype::strtype(const char *ptr)
+{
+    p = buf;
+    set_length(0);
+    assign(ptr, strlen(ptr));
+}
+
+strtype::strtype(const strtype &other)
+{
+    p = buf;
+    set_length(0);
+    assign(other.p, other.length());
+}
+
+strtype::strtype(strtype &&other) noexcept
+{
+    if (other.is_inline())
+    {
+        memcpy(buf, other.buf, sizeof(buf));
+        p = buf;
+    }
+    else
+    {
+        // Take over the malloc() block and leave other as an empty inline string.
+        p = other.p;
+        heap = other.heap;
+        other.p = other.buf;
+        other.set_length(0);
+    }
+}
+
+// Free memory when destroying a long string object.
+strtype::~strtype()
+{
+    if (!is_inline())
+        free(p);
+}
+
+strtype &strtype::operator=(const strtype &other)
+{
+    if (this != &other)
+        assign(other.p, other.length());
+    return *this;
+}
+
+strtype &strtype::operator=(strtype &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (!is_inline())
+            free(p);
+        new (this) strtype(std::move(other));
+    }
+    return *this;
+}
+
+void strtype::set(const char *ptr)
+{
+    assign(ptr, strlen(ptr));
+}
+
+void strtype::show() const
+{
+    cout << p << " - length : " << length();
+    cout << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// The strtype from 2.cpp, without the "Freeing p" message.
+class old_strtype
+{
+    char *p;
+    int len;
+
+public:
+    old_strtype()
+    {
+        p = (char *)counted_malloc(SIZE);
+        *p = '\0';
+        len = 0;
+    }
+    ~old_strtype() { free(p); }
+    old_strtype(const old_strtype &) = delete;
+    old_strtype &operator=(const old_strtype &) = delete;
+    void set(const char *ptr)
+    {
+        if (strlen(ptr) >= SIZE)
+            return;
+        strcpy(p, ptr);
+        len = strlen(p);
+    }
+    size_t length() const { return len; }
+};
+
+// Construct, set and destroy count objects. Returns nanoseconds per object.
+template <class String>
+double time_names(char names[][16], size_t distinct, size_t count, unsigned long &allocs, size_t &total_len)
+{
+    unsigned long before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        String s;
+        s.set(names[i % distinct]);
+        total_len += s.length();
+    }
+    auto end = chrono::steady_clock::now();
+    allocs = allocations - before;
+    return chrono::duration<double, nano>(end - start).count() / count;
+}
+
+int main()
+{
+    strtype s1, s2;
+    s1.set(" This is a test .");
+    s2.set("I like C++, and this string is far too long for the old strtype.");
+    s1.show();
+    s2.show();
+    cout << "s1 is " << (s1.stored_inline() ? "inline" : "on the heap") << ", s2 is "
+         << (s2.stored_inline() ? "inline" : "on the heap") << "\n";
+
+    strtype s3 = s1; // a real copy now, not a shared pointer
+    s3.set("copy");
+    cout << "After changing the copy, s1 is still: " << s1.c_str() << "\n";
+    cout << "sizeof(strtype) = " << sizeof(strtype) << " bytes\n\n";
+
+    const size_t distinct = 1000, count = 5000000;
+    static char names[distinct][16];
+    for (size_t i = 0; i < distinct; i++)
+        snprintf(names[i], sizeof(names[i]), "user_%zu", i * 7919 % 100000);
+
+    unsigned long old_allocs, sso_allocs;
+    size_t total_len = 0;
+    double old_ns = time_names<old_strtype>(names, distinct, count, old_allocs, total_len);
+    double sso_ns = time_names<strtype>(names, distinct, count, sso_allocs, total_len);
+
+    cout << count << " short names constructed and destroyed:\n";
+    cout << "  malloc(SIZE) strtype: " << old_ns << " ns/object, " << old_allocs << " allocations\n";
+    cout << "  SSO strtype:          " << sso_ns << " ns/object, " << sso_allocs << " allocations\n";
+    cout << "  speedup " << old_ns / sso_ns << "x (total length " << total_len << ")\n";
+    return 0;
+}
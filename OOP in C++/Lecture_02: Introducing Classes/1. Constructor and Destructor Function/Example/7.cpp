@@ -0,0 +1,280 @@
+/*
+7. In 2.cpp every strtype calls malloc() in its constructor and free() in its destructor.
+When a program builds hundreds of thousands of strings for one batch of work and then
+drops them all together, those individual free() calls are wasted effort.
+
+This program adds an arena (also called a monotonic or bump allocator). An arena gets
+memory from malloc() in large chunks and hands out pieces of a chunk by moving a pointer
+forward. A piece is never freed on its own; destroying the arena (or calling reset())
+gives back every chunk at once. The arena reports:
+    bytes_used()      bytes handed out since the last reset
+    bytes_wasted()    bytes lost to alignment padding and to unused chunk tails
+    high_water_mark() the largest bytes_used() ever reached
+A request bigger than a quarter of a chunk gets a chunk of its own, so one large
+string does not waste the rest of a normal chunk.
+
+strtype gets a second constructor that takes an arena. Such a string copies its
+characters into the arena and its destructor does nothing; a string built without an
+arena still uses malloc() and free() as before.
+
+main() builds a batch of one million strings both ways and compares the time.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 7.cpp -o arena_strtype
+*/
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Declare a bump allocator that frees everything at once.
+class arena
+{
+    struct chunk
+    {
+        chunk *next;
+        size_t size; // usable bytes after the header
+    };
+
+    chunk *chunks;     // all chunks, newest first
+    char *cur;         // next free byte in the current chunk
+    char *end;         // end of the current chunk
+    size_t chunk_size; // usable size of a normal chunk
+    size_t used;
+    size_t wasted;
+    size_t high_water;
+    size_t reserved; // total bytes obtained from malloc()
+
+    char *new_chunk(size_t size);
+
+public:
+    explicit arena(size_t chunk_bytes = 64 * 1024); // constructor
+    ~arena();                                      // destructor: frees every chunk
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+
+    void *allocate(size_t n, size_t align = alignof(max_align_t));
+    void reset();
+
+    size_t bytes_used() const { return used; }
+    size_t bytes_wasted() const { return wasted; }
+    size_t high_water_mark() const { return high_water; }
+    size_t bytes_reserved() const { return reserved; }
+};
+
+arena::arena(size_t chunk_bytes)
+{
+    chunks = nullptr;
+    cur = end = nullptr;
+    chunk_size = chunk_bytes;
+    used = wasted = high_water = reserved = 0;
+}
+
+arena::~arena()
+{
+    while (chunks)
+    {
+        chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+}
+
+// Get a chunk with size usable bytes from malloc() and link it in.
+char *arena::new_chunk(size_t size)
+{
+    chunk *c = (chunk *)malloc(sizeof(chunk) + size);
+    if (!c)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    c->next = chunks;
+    c->size = size;
+    chunks = c;
+    reserved += sizeof(chunk) + size;
+    return (char *)(c + 1);
+}
+
+// Hand out n bytes aligned to align (a power of two).
+void *arena::allocate(size_t n, size_t align)
+{
+    size_t pad = (align - (uintptr_t)cur % align) % align;
+    if (cur && pad + n <= size_t(end - cur))
+    {
+        char *p = cur + pad;
+        cur = p + n;
+        used += n;
+        wasted += pad;
+        if (used > high_water)
+            high_water = used;
+        return p;
+    }
+
+    if (n + align > chunk_size / 4)
+    {
+        // A big request gets its own chunk; the current chunk stays in use.
+        char *big = new_chunk(n + align);
+        char *p = big + (align - (uintptr_t)big % align) % align;
+        used += n;
+        wasted += align;
+        if (used > high_water)
+            high_water = used;
+        return p;
+    }
+
+    wasted += size_t(end - cur); // the unused tail of the old chunk
+    cur = new_chunk(chunk_size);
+    end = cur + chunk_size;
+    return allocate(n, align); // fits now
+}
+
+// Release everything handed out so far. The high-water mark is kept.
+void arena::reset()
+{
+    while (chunks)
+    {
+        chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    cur = end = nullptr;
+    used = wasted = reserved = 0;
+}
+
+class strtype
+{
+    char *p;
+    int len;
+    bool in_arena; // true if p belongs to an arena, which frees it
+
+public:
+    strtype(const char *ptr);            // constructor: malloc() storage
+    strtype(const char *ptr, arena &a);  // constructor: storage from the arena
+    ~strtype();                          // destructor
+    strtype(const strtype &) = delete;
+    strtype &operator=(const strtype &) = delete;
+    strtype(strtype &&other) noexcept;
+    void show();
+    int length() const { return len; }
+};
+
+strtype::strtype(const char *ptr)
+{
+    len = strlen(ptr);
+    p = (char *)malloc(len + 1);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    strcpy(p, ptr);
+    in_arena = false;
+}
+
+strtype::strtype(const char *ptr, arena &a)
+{
+    len = strlen(ptr);
+    p = (char *)a.allocate(len + 1, 1); // characters need no alignment
+    memcpy(p, ptr, len + 1);
+    in_arena = true;
+}
+
+strtype::strtype(strtype &&other) noexcept
+{
+    p = other.p;
+    len = other.len;
+    in_arena = other.in_arena;
+    other.p = nullptr;
+    other.in_arena = false;
+}
+
+// Free memory when destroying a string object, unless the arena owns it.
+strtype::~strtype()
+{
+    if (!in_arena)
+        free(p);
+}
+
+void strtype::show()
+{
+    cout << p << " - length : " << len;
+    cout << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// Build count strings, then drop them all. Returns seconds for the whole batch.
+double time_malloc_batch(char names[][24], size_t distinct, size_t count, long &total)
+{
+    auto start = chrono::steady_clock::now();
+    {
+        vector<strtype> batch;
+        batch.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            batch.emplace_back(names[i % distinct]);
+        total += batch.back().length();
+    } // one free() per string here
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double time_arena_batch(char names[][24], size_t distinct, size_t count, long &total, arena &a)
+{
+    auto start = chrono::steady_clock::now();
+    {
+        vector<strtype> batch;
+        batch.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            batch.emplace_back(names[i % distinct], a);
+        total += batch.back().length();
+    }
+    a.reset(); // every string released at once
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    arena a;
+    strtype s1(" This is a test .", a), s2("I like C++. ");
+    s1.show();
+    s2.show();
+    cout << "arena: " << a.bytes_used() << " bytes used\n\n";
+
+    const size_t distinct = 4096, count = 1000000;
+    static char names[distinct][24];
+    for (size_t i = 0; i < distinct; i++)
+        snprintf(names[i], sizeof(names[i]), "%s_%zu", i % 3 ? "item" : "category", i * 2654435761u % 1000000);
+
+    arena batch_arena(1 << 20);
+    long total = 0;
+    double malloc_s = time_malloc_batch(names, distinct, count, total);
+
+    // Fill the arena once more without resetting, to show the statistics for a full batch.
+    {
+        vector<strtype> batch;
+        batch.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            batch.emplace_back(names[i % distinct], batch_arena);
+    }
+    cout << "After one batch of " << count << " strings:\n";
+    cout << "  bytes used      " << batch_arena.bytes_used() << "\n";
+    cout << "  bytes wasted    " << batch_arena.bytes_wasted() << "\n";
+    cout << "  bytes reserved  " << batch_arena.bytes_reserved() << "\n";
+    batch_arena.reset();
+
+    double arena_s = time_arena_batch(names, distinct, count, total, batch_arena);
+    cout << "  high-water mark " << batch_arena.high_water_mark() << "\n\n";
+
+    cout << "Build and release " << count << " strings:\n";
+    cout << "  malloc/free per string: " << malloc_s * 1e3 << " ms\n";
+    cout << "  arena:                  " << arena_s * 1e3 << " ms\n";
+    cout << "  speedup " << malloc_s / arena_s << "x (checksum " << total << ")\n";
+    return 0;
+}
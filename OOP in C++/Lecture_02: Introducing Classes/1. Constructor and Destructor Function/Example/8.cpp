@@ -0,0 +1,371 @@
+/*
+8. set() in 2.cpp replaces the whole string with strcpy(). Building a large report by
+concatenation with a class like that means: allocate a block one piece longer, copy the
+whole string so far, add the piece, free the old block. The copying grows with the
+length, so n appends cost O(n^2) in total.
+
+This program adds rope, a companion class to strtype for building large strings. A rope
+keeps its text in chunks of up to 4 KB, held in a balanced binary tree (a treap ordered
+by position, where each node also records the length of its subtree).
+    append(s)          copies s into a 4 KB tail buffer; only a full buffer is added
+                       to the tree, so append is O(1) amortized
+    insert(pos, s)     splits the tree at pos and joins the pieces back: O(log n)
+    substring(pos, n)  finds pos in O(log n) and copies the n characters out
+    flatten()          copies everything, once, into one contiguous strtype
+The tree uses random priorities, which keeps it balanced with high probability.
+
+main() builds a 100 MB string from 10 million small appends with the rope, and compares
+it with naive reallocate-and-copy appends. The naive version is too slow to run all
+the way to 100 MB, so it is timed on smaller sizes to show the quadratic growth.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 8.cpp -o rope
+*/
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+void *checked_malloc(size_t n)
+{
+    void *p = malloc(n);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    return p;
+}
+
+class rope;
+
+class strtype
+{
+    char *p;
+    size_t len;
+
+    friend class rope;
+    strtype(char *owned, size_t n) : p(owned), len(n) {} // takes ownership of owned
+
+public:
+    strtype(const char *ptr)
+    {
+        len = strlen(ptr);
+        p = (char *)checked_malloc(len + 1);
+        memcpy(p, ptr, len + 1);
+    }
+    strtype(strtype &&other) noexcept : p(other.p), len(other.len)
+    {
+        other.p = nullptr;
+        other.len = 0;
+    }
+    ~strtype() { free(p); }
+    strtype(const strtype &) = delete;
+    strtype &operator=(const strtype &) = delete;
+
+    // Naive append: a new block, a copy of everything so far, then the new piece.
+    void append_copy(const char *s, size_t n)
+    {
+        char *fresh = (char *)checked_malloc(len + n + 1);
+        memcpy(fresh, p, len);
+        memcpy(fresh + len, s, n);
+        fresh[len + n] = '\0';
+        free(p);
+        p = fresh;
+        len += n;
+    }
+
+    void show() const
+    {
+        cout << p << " - length : " << len;
+        cout << "\n";
+    }
+    const char *c_str() const { return p; }
+    size_t length() const { return len; }
+};
+
+// Declare a rope: a string held as a balanced tree of chunks.
+class rope
+{
+    static const size_t CHUNK = 4096;
+
+    struct node
+    {
+        node *left, *right;
+        uint32_t priority; // heap order on priorities keeps the tree balanced
+        size_t total;      // characters in this subtree
+        size_t len;        // characters in this node's chunk
+        char *data;
+    };
+
+    node *root;
+    char *tail;      // append buffer, not yet in the tree
+    size_t tail_len;
+    uint32_t seed;
+
+    static size_t size_of(node *t) { return t ? t->total : 0; }
+    static void update(node *t) { t->total = size_of(t->left) + t->len + size_of(t->right); }
+    node *make_node(const char *s, size_t n);
+    static node *merge(node *a, node *b);
+    void split(node *t, size_t pos, node *&a, node *&b);
+    static void destroy(node *t);
+    static char *copy_out(node *t, char *dst, size_t &skip, size_t &want);
+    node *build(const char *s, size_t n);
+    void flush_tail();
+
+public:
+    rope();
+    ~rope();
+    rope(const rope &) = delete;
+    rope &operator=(const rope &) = delete;
+
+    void append(const char *s, size_t n);
+    void append(const char *s) { append(s, strlen(s)); }
+    void insert(size_t pos, const char *s);
+    strtype substring(size_t pos, size_t n);
+    strtype flatten();
+    size_t length() const { return size_of(root) + tail_len; }
+};
+
+rope::rope()
+{
+    root = nullptr;
+    tail = (char *)checked_malloc(CHUNK);
+    tail_len = 0;
+    seed = 2463534242u;
+}
+
+rope::~rope()
+{
+    destroy(root);
+    free(tail);
+}
+
+void rope::destroy(node *t)
+{
+    if (!t)
+        return;
+    destroy(t->left);
+    destroy(t->right);
+    free(t->data);
+    delete t;
+}
+
+rope::node *rope::make_node(const char *s, size_t n)
+{
+    seed ^= seed << 13; // xorshift32
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    node *t = new node;
+    t->left = t->right = nullptr;
+    t->priority = seed;
+    t->len = n;
+    t->total = n;
+    t->data = (char *)checked_malloc(n ? n : 1);
+    memcpy(t->data, s, n);
+    return t;
+}
+
+// Join two trees where every character of a comes before every character of b.
+rope::node *rope::merge(node *a, node *b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a->priority > b->priority)
+    {
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    update(b);
+    return b;
+}
+
+// Split t into the first pos characters (a) and the rest (b), cutting a chunk if needed.
+void rope::split(node *t, size_t pos, node *&a, node *&b)
+{
+    if (!t)
+    {
+        a = b = nullptr;
+        return;
+    }
+    size_t left_size = size_of(t->left);
+    if (pos <= left_size)
+    {
+        split(t->left, pos, a, t->left);
+        update(t);
+        b = t;
+    }
+    else if (pos >= left_size + t->len)
+    {
+        split(t->right, pos - left_size - t->len, t->right, b);
+        update(t);
+        a = t;
+    }
+    else
+    {
+        // pos falls inside this chunk: move its second half into a new node.
+        size_t cut = pos - left_size;
+        node *rest = make_node(t->data + cut, t->len - cut);
+        t->len = cut;
+        node *right = t->right;
+        t->right = nullptr;
+        update(t);
+        a = t; // t and its left subtree now end exactly at pos
+        b = merge(rest, right);
+    }
+}
+
+// Build a tree from n characters, CHUNK characters per node.
+rope::node *rope::build(const char *s, size_t n)
+{
+    node *t = nullptr;
+    for (size_t off = 0; off < n; off += CHUNK)
+        t = merge(t, make_node(s + off, n - off < CHUNK ? n - off : CHUNK));
+    return t;
+}
+
+// Move the tail buffer into the tree.
+void rope::flush_tail()
+{
+    if (tail_len == 0)
+        return;
+    root = merge(root, make_node(tail, tail_len));
+    tail_len = 0;
+}
+
+void rope::append(const char *s, size_t n)
+{
+    while (n > 0)
+    {
+        size_t room = CHUNK - tail_len;
+        size_t take = n < room ? n : room;
+        memcpy(tail + tail_len, s, take);
+        tail_len += take;
+        s += take;
+        n -= take;
+        if (tail_len == CHUNK)
+            flush_tail();
+    }
+}
+
+void rope::insert(size_t pos, const char *s)
+{
+    flush_tail();
+    if (pos > size_of(root))
+        pos = size_of(root);
+    node *a, *b;
+    split(root, pos, a, b);
+    root = merge(merge(a, build(s, strlen(s))), b);
+}
+
+// Copy characters from the in-order walk of t: skip the first skip, then take want.
+char *rope::copy_out(node *t, char *dst, size_t &skip, size_t &want)
+{
+    if (!t || want == 0)
+        return dst;
+    if (skip >= t->total)
+    {
+        skip -= t->total; // whole subtree lies before the range: O(1)
+        return dst;
+    }
+    dst = copy_out(t->left, dst, skip, want);
+    if (want > 0)
+    {
+        if (skip >= t->len)
+            skip -= t->len;
+        else
+        {
+            size_t n = t->len - skip < want ? t->len - skip : want;
+            memcpy(dst, t->data + skip, n);
+            dst += n;
+            want -= n;
+            skip = 0;
+        }
+    }
+    return copy_out(t->right, dst, skip, want);
+}
+
+strtype rope::substring(size_t pos, size_t n)
+{
+    flush_tail();
+    size_t total = size_of(root);
+    if (pos > total)
+        pos = total;
+    if (n > total - pos)
+        n = total - pos;
+    char *out = (char *)checked_malloc(n + 1);
+    size_t skip = pos, want = n;
+    copy_out(root, out, skip, want);
+    out[n] = '\0';
+    return strtype(out, n);
+}
+
+strtype rope::flatten()
+{
+    return substring(0, length());
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+int main()
+{
+    rope r;
+    r.append("I like C++.");
+    r.insert(7, "writing ");
+    r.insert(0, "Yes, ");
+    strtype s = r.flatten();
+    s.show();
+    strtype part = r.substring(5, 14);
+    part.show();
+    cout << "\n";
+
+    // 10M appends of 10-character pieces, 100 MB in total.
+    const size_t appends = 10000000;
+    static char pieces[100][16];
+    for (int i = 0; i < 100; i++)
+        snprintf(pieces[i], sizeof(pieces[i]), "item %04d;", i * 37);
+    size_t piece_len = strlen(pieces[0]);
+
+    auto t0 = chrono::steady_clock::now();
+    rope report;
+    for (size_t i = 0; i < appends; i++)
+        report.append(pieces[i % 100], piece_len);
+    auto t1 = chrono::steady_clock::now();
+    strtype flat = report.flatten();
+    auto t2 = chrono::steady_clock::now();
+
+    double append_s = chrono::duration<double>(t1 - t0).count();
+    cout << "rope: " << appends << " appends, " << flat.length() / 1000000 << " MB\n";
+    cout << "  appends " << append_s * 1e3 << " ms (" << append_s * 1e9 / appends << " ns each), flatten "
+         << chrono::duration<double>(t2 - t1).count() * 1e3 << " ms\n";
+
+    auto t3 = chrono::steady_clock::now();
+    report.insert(flat.length() / 2, "<<inserted in the middle>>");
+    strtype middle = report.substring(flat.length() / 2 - 4, 34);
+    auto t4 = chrono::steady_clock::now();
+    cout << "  insert + substring in the middle of 100 MB: " << chrono::duration<double, micro>(t4 - t3).count()
+         << " us -> \"" << middle.c_str() << "\"\n\n";
+
+    cout << "naive reallocate-and-copy:\n";
+    for (size_t n = 10000; n <= 40000; n *= 2)
+    {
+        strtype naive("");
+        auto n0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++)
+            naive.append_copy(pieces[i % 100], piece_len);
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - n0).count();
+        double per = secs / n;
+        cout << "  " << n << " appends: " << secs * 1e3 << " ms (" << per * 1e9 << " ns each)";
+        cout << ", 10M appends would take ~" << per * appends * (double(appends) / n) / 3600 << " hours\n";
+    }
+    return 0;
+}
@@ -0,0 +1,395 @@
+/*
+9. The timer of 3.cpp has two problems. clock() measures processor time, not the time
+that passes on the wall clock, and (end - start) / CLOCKS_PER_SEC is an integer division,
+so anything shorter than a second is reported as 0 seconds.
+
+This program keeps the idea of 3.cpp (the constructor starts timing, the destructor
+stops it) and turns it into a timer that can be left in real code:
+  - Time is read from a monotonic clock with nanosecond resolution (steady_clock). On
+    x86 CPUs whose time-stamp counter runs at a constant rate, timer_clock::calibrate()
+    measures the counter against steady_clock once, and after that a scope is timed
+    with the rdtsc instruction, which is cheaper than a clock call.
+  - A timer has a name, and timers nest: a timer created while another is running
+    becomes its child, so "load/parse" and "save/parse" are reported separately.
+  - Instead of printing, the destructor adds the elapsed time to a histogram that
+    belongs to the scope and to the current thread, so threads never share counters.
+    The histogram is log-linear: 16 buckets for each power of two, which keeps every
+    value within about 6% and covers nanoseconds to hours in under 1000 counters.
+  - timer::report() merges all threads and prints count, mean, p50, p99, p99.9 and max
+    for every scope; timer::report_at_exit() arranges for that to happen when the
+    program ends.
+
+main() measures the cost of an empty timed scope with both clocks, then times some
+nested work in two threads and prints the report.
+
+Compile with:
+    g++ -std=c++17 -O2 -pthread 9.cpp -o scoped_timer
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TIMER_HAS_TSC 1
+#endif
+using namespace std;
+
+// The clock behind every timer: steady_clock, or the calibrated time-stamp counter.
+class timer_clock
+{
+    static bool tsc;
+    static double ns_per_tick;
+
+public:
+    static uint64_t now() // ticks of the current clock
+    {
+#ifdef TIMER_HAS_TSC
+        if (tsc)
+            return __rdtsc();
+#endif
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static uint64_t to_ns(uint64_t ticks) { return tsc ? uint64_t(ticks * ns_per_tick) : ticks; }
+    static bool calibrate(); // switch to the TSC if the CPU has an invariant one
+    static void use_steady() { tsc = false; }
+    static bool using_tsc() { return tsc; }
+    static double tsc_ghz() { return 1.0 / ns_per_tick; }
+};
+
+bool timer_clock::tsc = false;
+double timer_clock::ns_per_tick = 1.0;
+
+bool timer_clock::calibrate()
+{
+#ifdef TIMER_HAS_TSC
+    // CPUID leaf 0x80000007, EDX bit 8: the TSC runs at a constant rate in every power state.
+    unsigned a, b, c, d;
+    if (!__get_cpuid(0x80000007, &a, &b, &c, &d) || !(d & (1u << 8)))
+        return false;
+    auto t0 = chrono::steady_clock::now();
+    uint64_t c0 = __rdtsc();
+    while (chrono::steady_clock::now() - t0 < chrono::milliseconds(50))
+        ;
+    uint64_t c1 = __rdtsc();
+    auto t1 = chrono::steady_clock::now();
+    ns_per_tick = chrono::duration<double, nano>(t1 - t0).count() / double(c1 - c0);
+    tsc = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Log-linear latency histogram: values below 16 are exact, above that each power of two
+// is split into 16 buckets.
+class histogram
+{
+public:
+    static const int SUB = 16;
+    static const int BUCKETS = (64 - 3) * SUB;
+
+private:
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t largest;
+
+    static int index(uint64_t v)
+    {
+        if (v < SUB)
+            return int(v);
+        int e = 63 - __builtin_clzll(v); // position of the highest set bit, at least 4
+        return (e - 3) * SUB + int((v >> (e - 4)) & (SUB - 1));
+    }
+    static uint64_t lower_bound(int i)
+    {
+        if (i < SUB)
+            return uint64_t(i);
+        int e = i / SUB + 3;
+        return (uint64_t(SUB + i % SUB)) << (e - 4);
+    }
+
+public:
+    histogram() { clear(); }
+    void clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        total = sum = largest = 0;
+    }
+    void record(uint64_t v)
+    {
+        counts[index(v)]++;
+        total++;
+        sum += v;
+        if (v > largest)
+            largest = v;
+    }
+    void merge(const histogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        largest = max(largest, other.largest);
+    }
+    uint64_t count() const { return total; }
+    double mean() const { return total ? double(sum) / total : 0; }
+    uint64_t max_value() const { return largest; }
+    // The value below which a fraction q of the samples fall (middle of its bucket).
+    uint64_t percentile(double q) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = uint64_t(ceil(q * total)), seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank && counts[i])
+            {
+                uint64_t lo = lower_bound(i), hi = i + 1 < BUCKETS ? lower_bound(i + 1) : lo;
+                return min(largest, lo + (hi - lo) / 2);
+            }
+        }
+        return largest;
+    }
+};
+
+// Declare a scoped timer. Each thread keeps a tree of the scopes it has entered.
+class timer
+{
+    struct scope_node
+    {
+        const char *name;
+        int parent;
+        int last_child; // the child entered most recently, checked first
+        vector<int> children;
+        histogram hist;
+    };
+
+    struct thread_profile
+    {
+        vector<scope_node> nodes; // nodes[0] is the root, the thread itself
+        int current = 0;
+        thread_profile() { nodes.push_back(scope_node{"", -1, -1, {}, {}}); }
+        int child(const char *name);
+    };
+
+    // Profiles are never freed, so threads that have finished still appear in the report.
+    static mutex registry_lock;
+    static vector<thread_profile *> &registry();
+    static thread_profile &profile();
+    static void collect(const thread_profile &p, int n, const string &path, vector<pair<string, histogram>> &out);
+
+    thread_profile &prof;
+    int node;
+    uint64_t start;
+
+public:
+    explicit timer(const char *name) : prof(profile())
+    {
+        node = prof.child(name);
+        prof.current = node;
+        start = timer_clock::now(); // The constructor starts timing last...
+    }
+    ~timer()
+    {
+        uint64_t elapsed = timer_clock::now() - start; // ...and the destructor stops it first.
+        prof.nodes[node].hist.record(timer_clock::to_ns(elapsed));
+        prof.current = prof.nodes[node].parent;
+    }
+    timer(const timer &) = delete;
+    timer &operator=(const timer &) = delete;
+
+    static void report(ostream &out = cout); // call when the timed threads are finished
+    static void report_at_exit();
+    static void reset();
+};
+
+mutex timer::registry_lock;
+
+vector<timer::thread_profile *> &timer::registry()
+{
+    static vector<thread_profile *> *all = new vector<thread_profile *>; // outlives atexit handlers
+    return *all;
+}
+
+timer::thread_profile &timer::profile()
+{
+    thread_local thread_profile *mine = nullptr;
+    if (!mine)
+    {
+        mine = new thread_profile;
+        lock_guard<mutex> guard(registry_lock);
+        registry().push_back(mine);
+    }
+    return *mine;
+}
+
+// Find or add the child of the current scope called name. Scope names are usually string
+// literals, so the pointer is compared first.
+int timer::thread_profile::child(const char *name)
+{
+    int last = nodes[current].last_child;
+    if (last >= 0 && nodes[last].name == name)
+        return last;
+    for (int c : nodes[current].children)
+        if (nodes[c].name == name || strcmp(nodes[c].name, name) == 0)
+            return nodes[current].last_child = c;
+    int id = int(nodes.size());
+    nodes.push_back(scope_node{name, current, -1, {}, {}});
+    nodes[current].children.push_back(id);
+    nodes[current].last_child = id;
+    return id;
+}
+
+void timer::collect(const thread_profile &p, int n, const string &path, vector<pair<string, histogram>> &out)
+{
+    for (int c : p.nodes[n].children)
+    {
+        string child_path = path.empty() ? p.nodes[c].name : path + "/" + p.nodes[c].name;
+        auto it = find_if(out.begin(), out.end(), [&](const pair<string, histogram> &e) { return e.first == child_path; });
+        if (it == out.end())
+        {
+            out.emplace_back(child_path, histogram());
+            it = out.end() - 1;
+        }
+        it->second.merge(p.nodes[c].hist);
+        collect(p, c, child_path, out);
+    }
+}
+
+void timer::report(ostream &out)
+{
+    vector<pair<string, histogram>> scopes;
+    {
+        lock_guard<mutex> guard(registry_lock);
+        for (thread_profile *p : registry())
+            collect(*p, 0, "", scopes);
+    }
+    sort(scopes.begin(), scopes.end(),
+         [](const pair<string, histogram> &a, const pair<string, histogram> &b) { return a.first < b.first; });
+
+    char line[200];
+    snprintf(line, sizeof(line), "%-28s %10s %12s %12s %12s %12s %12s\n", "scope (ns)", "count", "mean", "p50", "p99",
+             "p99.9", "max");
+    out << line;
+    for (auto &s : scopes)
+    {
+        const histogram &h = s.second;
+        if (h.count() == 0)
+            continue;
+        snprintf(line, sizeof(line), "%-28s %10llu %12.0f %12llu %12llu %12llu %12llu\n", s.first.c_str(),
+                 (unsigned long long)h.count(), h.mean(), (unsigned long long)h.percentile(0.5),
+                 (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+                 (unsigned long long)h.max_value());
+        out << line;
+    }
+}
+
+void timer::report_at_exit()
+{
+    atexit([] { report(cout); });
+}
+
+void timer::reset()
+{
+    lock_guard<mutex> guard(registry_lock);
+    for (thread_profile *p : registry())
+        for (scope_node &n : p->nodes)
+            n.hist.clear();
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// Nanoseconds per empty timed scope, measured without the timer around it.
+double scope_overhead_ns(size_t reps)
+{
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < reps; i++)
+    {
+        timer t("overhead");
+        asm volatile("" ::: "memory");
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count() / reps;
+}
+
+// Nanoseconds for the two clock reads alone, the part of the overhead the timer cannot avoid.
+double clock_pair_ns(size_t reps)
+{
+    uint64_t sink = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < reps; i++)
+    {
+        uint64_t a = timer_clock::now();
+        sink += timer_clock::now() - a;
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count() / reps;
+    return sink == 1 ? 0 : ns; // use sink so the loop is kept
+}
+
+long work(unsigned seed, size_t n)
+{
+    timer t("work");
+    vector<unsigned> v(n);
+    {
+        timer f("fill");
+        for (auto &x : v)
+            x = seed = seed * 1664525u + 1013904223u;
+    }
+    {
+        timer s("sort");
+        sort(v.begin(), v.end());
+    }
+    long sum = 0;
+    {
+        timer s("sum");
+        for (unsigned x : v)
+            sum += x >> 20;
+    }
+    return sum;
+}
+
+int main()
+{
+    const size_t reps = 10000000;
+    cout << "Timer overhead per scope (of which the two clock reads):\n";
+    timer_clock::use_steady();
+    cout << "  steady_clock " << scope_overhead_ns(reps) << " ns (" << clock_pair_ns(reps) << " ns)\n";
+    if (timer_clock::calibrate())
+        cout << "  TSC (" << timer_clock::tsc_ghz() << " GHz)    " << scope_overhead_ns(reps) << " ns ("
+             << clock_pair_ns(reps) << " ns)\n";
+    else
+        cout << "  TSC not available, using steady_clock\n";
+    cout << "\n";
+    timer::reset();
+
+    timer::report_at_exit();
+    long checksum = 0;
+    {
+        timer t("main");
+        thread other([&] {
+            timer u("worker");
+            for (unsigned i = 0; i < 200; i++)
+                work(i + 1000, 20000);
+        });
+        long local = 0;
+        for (unsigned i = 0; i < 200; i++)
+            local += work(i, 20000);
+        other.join();
+        checksum += local;
+    }
+    cout << "checksum " << checksum << "\n\n";
+    return 0; // the report is printed here, when the program ends
+}
@@ -0,0 +1,330 @@
+/*
+5. The named stack in 2.cpp only works from a single thread: if two threads push at the same
+time, both can write stck[tos] before either increments tos. Here is a concurrent version
+of that class. The constructor still takes the one-character name, and the name is still
+used to identify the stack in diagnostics.
+
+push() and pop() are lock-free (Treiber's algorithm). Each element lives in a node, and
+the stack is a singly linked list of nodes whose head is swapped with compare-and-swap.
+The classic danger is the ABA problem: a thread reads head A, another thread pops A,
+pops B and pushes A back, and the first thread's CAS wrongly succeeds. To rule that out,
+nodes are addressed by a 32-bit index into a pool that is never freed while the stack is
+alive, and the head word packs that index together with a 32-bit tag that changes on
+every successful CAS. Popped nodes go to a second lock-free list and are reused.
+
+Each stack also counts CAS retries and pops that found the stack empty, so contention
+can be seen per stack. main() compares throughput with a mutex-guarded stack for 1 to 64
+threads doing a mix of pushes and pops.
+
+Compile with:
+    g++ -std=c++17 -O2 -pthread 5.cpp -o concurrent_stack
+*/
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Declare a lock-free stack that can be shared by many threads.
+template <class T>
+class stack
+{
+    struct node
+    {
+        atomic<uint32_t> next;                  // index of the node below this one
+        alignas(T) unsigned char storage[sizeof(T)]; // the element, constructed by push()
+        T *value() { return reinterpret_cast<T *>(storage); }
+    };
+
+    static const uint32_t NIL = 0xFFFFFFFFu; // "no node" index
+    static const unsigned FIRST_CHUNK_BITS = 10; // the first pool chunk holds 1024 nodes
+    static const unsigned MAX_CHUNKS = 22;       // each chunk doubles, so up to ~4 billion nodes
+
+    // Head words: high 32 bits are the ABA tag, low 32 bits are the node index.
+    // They sit on their own cache lines so that pushers do not also fight over the counters.
+    alignas(64) atomic<uint64_t> head;      // elements on the stack
+    alignas(64) atomic<uint64_t> free_head; // nodes available for reuse
+    alignas(64) atomic<unsigned long> retries;
+    atomic<unsigned long> empty_pops;
+    atomic<node *> chunks[MAX_CHUNKS];
+    char who; // identifies stack
+
+    static uint64_t pack(uint32_t tag, uint32_t idx) { return (uint64_t(tag) << 32) | idx; }
+    static uint32_t index_of(uint64_t word) { return uint32_t(word); }
+    static uint32_t tag_of(uint64_t word) { return uint32_t(word >> 32); }
+
+    node &at(uint32_t idx);
+    void push_list(atomic<uint64_t> &list, uint32_t first, uint32_t last);
+    uint32_t pop_list(atomic<uint64_t> &list);
+    uint32_t allocate_node();
+
+public:
+    explicit stack(char c); // constructor
+    ~stack();
+    stack(const stack &) = delete;
+    stack &operator=(const stack &) = delete;
+
+    void push(T value); // push an element; safe from any thread
+    bool pop(T &out);   // pop into out; returns false if the stack was empty
+
+    char name() const { return who; }
+    unsigned long cas_retries() const { return retries.load(memory_order_relaxed); }
+    unsigned long empty_pop_count() const { return empty_pops.load(memory_order_relaxed); }
+    void reset_counters();
+    void report() const;
+};
+
+// Initialize the stack.
+template <class T>
+stack<T>::stack(char c) : head(pack(0, NIL)), free_head(pack(0, NIL)), retries(0), empty_pops(0), who(c)
+{
+    for (unsigned k = 0; k < MAX_CHUNKS; k++)
+        chunks[k].store(nullptr, memory_order_relaxed);
+}
+
+// Destroy the remaining elements and free the node pool.
+template <class T>
+stack<T>::~stack()
+{
+    for (uint32_t idx = index_of(head.load()); idx != NIL;)
+    {
+        node &n = at(idx);
+        idx = n.next.load(memory_order_relaxed);
+        n.value()->~T();
+    }
+    for (unsigned k = 0; k < MAX_CHUNKS; k++)
+        delete[] chunks[k].load();
+}
+
+// Map a pool index to its node. Chunk k starts at index (1024 << k) - 1024 and holds 1024 << k nodes.
+template <class T>
+typename stack<T>::node &stack<T>::at(uint32_t idx)
+{
+    uint64_t biased = uint64_t(idx) + (1u << FIRST_CHUNK_BITS);
+    unsigned bit = 63 - __builtin_clzll(biased);
+    unsigned k = bit - FIRST_CHUNK_BITS;
+    return chunks[k].load(memory_order_acquire)[biased - (uint64_t(1) << bit)];
+}
+
+// Link the chain first..last (already linked through next) onto list with one CAS.
+template <class T>
+void stack<T>::push_list(atomic<uint64_t> &list, uint32_t first, uint32_t last)
+{
+    node &tail = at(last);
+    uint64_t old = list.load(memory_order_relaxed);
+    for (;;)
+    {
+        tail.next.store(index_of(old), memory_order_relaxed);
+        if (list.compare_exchange_weak(old, pack(tag_of(old) + 1, first), memory_order_release,
+                                       memory_order_relaxed))
+            return;
+        retries.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+// Unlink the first node of list. Returns NIL if the list is empty.
+template <class T>
+uint32_t stack<T>::pop_list(atomic<uint64_t> &list)
+{
+    uint64_t old = list.load(memory_order_acquire);
+    for (;;)
+    {
+        uint32_t idx = index_of(old);
+        if (idx == NIL)
+            return NIL;
+        // The node may be popped and reused by another thread right after we read it.
+        // That is harmless: nodes are never freed, and the tag makes the CAS below fail.
+        uint32_t next = at(idx).next.load(memory_order_relaxed);
+        if (list.compare_exchange_weak(old, pack(tag_of(old) + 1, next), memory_order_acquire,
+                                       memory_order_acquire))
+            return idx;
+        retries.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+// Take a node from the free list, or add a new chunk to the pool when it is empty.
+template <class T>
+uint32_t stack<T>::allocate_node()
+{
+    for (;;)
+    {
+        uint32_t idx = pop_list(free_head);
+        if (idx != NIL)
+            return idx;
+
+        unsigned k = 0;
+        while (k < MAX_CHUNKS && chunks[k].load(memory_order_acquire) != nullptr)
+            k++;
+        if (k == MAX_CHUNKS)
+            throw bad_alloc();
+
+        uint32_t count = 1u << (FIRST_CHUNK_BITS + k);
+        uint32_t base = count - (1u << FIRST_CHUNK_BITS);
+        node *fresh = new node[count];
+        for (uint32_t i = 1; i + 1 < count; i++)
+            fresh[i].next.store(base + i + 1, memory_order_relaxed);
+
+        node *expected = nullptr;
+        if (!chunks[k].compare_exchange_strong(expected, fresh, memory_order_acq_rel))
+        {
+            // Another thread grew the pool first; use its nodes instead.
+            delete[] fresh;
+            continue;
+        }
+        // Keep node 0 of the chunk for this push and hand the rest to the free list.
+        push_list(free_head, base + 1, base + count - 1);
+        return base;
+    }
+}
+
+// Push an element.
+template <class T>
+void stack<T>::push(T value)
+{
+    uint32_t idx = allocate_node();
+    ::new (static_cast<void *>(at(idx).storage)) T(std::move(value));
+    push_list(head, idx, idx);
+}
+
+// Pop an element.
+template <class T>
+bool stack<T>::pop(T &out)
+{
+    uint32_t idx = pop_list(head);
+    if (idx == NIL)
+    {
+        empty_pops.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    node &n = at(idx);
+    out = std::move(*n.value());
+    n.value()->~T();
+    push_list(free_head, idx, idx);
+    return true;
+}
+
+template <class T>
+void stack<T>::reset_counters()
+{
+    retries.store(0, memory_order_relaxed);
+    empty_pops.store(0, memory_order_relaxed);
+}
+
+template <class T>
+void stack<T>::report() const
+{
+    cout << " Stack " << who << ": " << cas_retries() << " CAS retries, " << empty_pop_count()
+         << " empty pops\n";
+}
+
+// The same interface guarded by a mutex, used as the baseline in the benchmark.
+template <class T>
+class locked_stack
+{
+    mutex lock;
+    vector<T> stck;
+    unsigned long empty_pops;
+    char who;
+
+public:
+    explicit locked_stack(char c) : empty_pops(0), who(c) {}
+    void push(T value)
+    {
+        lock_guard<mutex> guard(lock);
+        stck.push_back(std::move(value));
+    }
+    bool pop(T &out)
+    {
+        lock_guard<mutex> guard(lock);
+        if (stck.empty())
+        {
+            empty_pops++;
+            return false;
+        }
+        out = std::move(stck.back());
+        stck.pop_back();
+        return true;
+    }
+    void reset_counters() { empty_pops = 0; }
+    void report() const { cout << " Stack " << who << ": " << empty_pops << " empty pops\n"; }
+};
+
+// Every thread pushes two values and pops two, over and over, so the stack stays small
+// and producers and consumers collide on the head. Returns millions of operations per second.
+template <class Stack>
+double run_threads(Stack &s, unsigned threads, unsigned long total_ops)
+{
+    unsigned long per_thread = total_ops / threads / 4;
+    atomic<unsigned long> checksum(0);
+    vector<thread> workers;
+
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++)
+        workers.emplace_back([&s, &checksum, per_thread, t] {
+            unsigned long sum = 0;
+            long value = 0;
+            for (unsigned long i = 0; i < per_thread; i++)
+            {
+                s.push(long(t * per_thread + i));
+                s.push(long(i));
+                if (s.pop(value))
+                    sum += value;
+                if (s.pop(value))
+                    sum += value;
+            }
+            checksum.fetch_add(sum, memory_order_relaxed);
+        });
+    for (auto &w : workers)
+        w.join();
+    auto end = chrono::steady_clock::now();
+
+    // Drain whatever was left by pops that found the stack momentarily empty.
+    long value;
+    while (s.pop(value))
+        ;
+    double seconds = chrono::duration<double>(end - start).count();
+    return (4.0 * per_thread * threads) / seconds / 1e6;
+}
+
+int main()
+{
+    // Create two stacks that are automatically initialized, as in 2.cpp.
+    stack<char> s1('A'), s2('B');
+
+    s1.push('a');
+    s2.push('x');
+    s1.push('b');
+    s2.push('y');
+    s1.push('c');
+    s2.push('z');
+
+    char c;
+    // The extra pops now show up in the counters instead of as console messages.
+    for (int i = 0; i < 5; i++)
+        if (s1.pop(c))
+            cout << "Pop s1: " << c << "\n";
+    for (int i = 0; i < 5; i++)
+        if (s2.pop(c))
+            cout << "Pop s2: " << c << "\n";
+    s1.report();
+    s2.report();
+
+    cout << "\nMulti-producer/multi-consumer throughput (Mops/s):\n";
+    cout << "threads   lock-free   mutex     CAS retries\n";
+    const unsigned long total_ops = 4000000;
+    for (unsigned threads = 1; threads <= 64; threads *= 2)
+    {
+        stack<long> lock_free('L');
+        locked_stack<long> locked('M');
+        double lf = run_threads(lock_free, threads, total_ops);
+        double mx = run_threads(locked, threads, total_ops);
+        cout << threads << "\t  " << lf << "\t" << mx << "\t  " << lock_free.cas_retries() << "\n";
+    }
+    cout << "(hardware threads: " << thread::hardware_concurrency() << ")\n";
+    return 0;
+}
@@ -0,0 +1,255 @@
+/*
+4. In 2.cpp, s2 = s1 copies every element of s1's stck array into s2. If a program takes
+snapshots of a stack all the time (for example, to backtrack in a parser), that copy is
+paid on every snapshot even though most snapshots are thrown away unchanged.
+
+Here is a copy-on-write version of the stack class. The characters live in a separate
+buffer that carries a reference count. Assignment and copy construction only point the
+new stack at the same buffer and bump the count, which costs the same no matter how
+deep the stack is. The real copy is made by the first push() into a shared buffer.
+pop() only moves tos, so popping a snapshot never copies anything.
+
+The buffer also grows by doubling instead of stopping at SIZE. The reference count is a
+plain integer, so one stack and its snapshots must stay on one thread.
+
+main() shows that s2 is independent of s1 after s2 = s1, then times assignment at several
+depths against a deep-copying stack and measures the cost of the first write after a
+snapshot.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 4.cpp -o cow_stack
+*/
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Declare a copy-on-write stack class for characters.
+class stack
+{
+    struct buffer
+    {
+        long refs;       // number of stacks sharing this buffer
+        size_t capacity; // number of characters data can hold
+        char data[1];    // really capacity characters long
+    };
+
+    buffer *buf; // shared storage, or nullptr for a stack that never held anything
+    size_t tos;  // index of top of stack; each stack keeps its own
+
+    static buffer *allocate(size_t capacity);
+    void release();
+    void make_unique(size_t capacity);
+
+public:
+    stack();                                 // constructor
+    stack(const stack &other);               // shares other's buffer
+    ~stack();                                // destructor
+    stack &operator=(const stack &other);    // shares other's buffer
+    void push(char ch);                      // push character on stack
+    char pop();                              // pop character from stack
+    size_t count() const { return tos; }
+    bool shared() const { return buf && buf->refs > 1; }
+};
+
+stack::buffer *stack::allocate(size_t capacity)
+{
+    buffer *b = (buffer *)malloc(offsetof(buffer, data) + capacity);
+    if (!b)
+    {
+        cout << "Allocation error\n";
+        exit(1);
+    }
+    b->refs = 1;
+    b->capacity = capacity;
+    return b;
+}
+
+// Drop this stack's reference, freeing the buffer if it was the last one.
+void stack::release()
+{
+    if (buf && --buf->refs == 0)
+        free(buf);
+    buf = nullptr;
+}
+
+// Give this stack a buffer of its own with room for at least capacity characters.
+void stack::make_unique(size_t capacity)
+{
+    buffer *fresh = allocate(capacity);
+    if (buf)
+        memcpy(fresh->data, buf->data, tos); // only the live part needs copying
+    release();
+    buf = fresh;
+}
+
+// Initialize the stack.
+stack::stack()
+{
+    buf = nullptr;
+    tos = 0;
+}
+
+stack::stack(const stack &other)
+{
+    buf = other.buf;
+    tos = other.tos;
+    if (buf)
+        buf->refs++;
+}
+
+stack::~stack()
+{
+    release();
+}
+
+stack &stack::operator=(const stack &other)
+{
+    if (other.buf)
+        other.buf->refs++; // bump first so self-assignment is safe
+    release();
+    buf = other.buf;
+    tos = other.tos;
+    return *this;
+}
+
+// Push a character, copying the buffer first if it is shared or full.
+void stack::push(char ch)
+{
+    if (!buf)
+        make_unique(16);
+    else if (tos == buf->capacity)
+        make_unique(buf->capacity * 2);
+    else if (buf->refs > 1)
+        make_unique(buf->capacity);
+    buf->data[tos] = ch;
+    tos++;
+}
+
+// Pop a character.
+char stack::pop()
+{
+    if (tos == 0)
+    {
+        cout << "Stack is empty\n";
+        return 0;
+    }
+    tos--;
+    return buf->data[tos];
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// A stack that deep-copies on assignment, like the array in 2.cpp but growable.
+class copy_stack
+{
+    vector<char> stck;
+
+public:
+    void push(char ch) { stck.push_back(ch); }
+    char pop()
+    {
+        char ch = stck.back();
+        stck.pop_back();
+        return ch;
+    }
+};
+
+template <class Stack>
+void fill(Stack &s, size_t depth)
+{
+    for (size_t i = 0; i < depth; i++)
+        s.push(static_cast<char>('a' + i % 26));
+}
+
+// Nanoseconds per snapshot = source assignment.
+template <class Stack>
+double time_assign(const Stack &source, size_t reps, unsigned long &checksum)
+{
+    Stack snapshot;
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++)
+    {
+        snapshot = source;
+        checksum += static_cast<unsigned char>(snapshot.pop());
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / reps;
+}
+
+// Nanoseconds for the first push after a snapshot (the one that copies), and for a second push.
+template <class Stack>
+void time_first_write(const Stack &source, size_t reps, double &first_ns, double &second_ns)
+{
+    chrono::steady_clock::duration first(0), second(0);
+    for (size_t r = 0; r < reps; r++)
+    {
+        Stack snapshot = source;
+        auto t0 = chrono::steady_clock::now();
+        snapshot.push('x');
+        auto t1 = chrono::steady_clock::now();
+        snapshot.push('y');
+        auto t2 = chrono::steady_clock::now();
+        first += t1 - t0;
+        second += t2 - t1;
+    }
+    first_ns = chrono::duration<double, nano>(first).count() / reps;
+    second_ns = chrono::duration<double, nano>(second).count() / reps;
+}
+
+int main()
+{
+    stack s1, s2; // Create two stack objects
+
+    s1.push('a');
+    s1.push('b');
+    s1.push('c');
+
+    s2 = s1; // s2 shares s1's buffer; nothing is copied yet
+    cout << "After s2 = s1, shared: " << (s2.shared() ? "yes" : "no") << "\n";
+
+    s2.push('d'); // first write: s2 gets its own copy
+    cout << "After s2.push('d'), shared: " << (s2.shared() ? "yes" : "no") << "\n";
+
+    cout << "Contents of stack s1:\n";
+    while (s1.count() > 0)
+        cout << s1.pop() << ' ';
+    cout << "\nContents of stack s2:\n";
+    while (s2.count() > 0)
+        cout << s2.pop() << ' ';
+    cout << "\n\n";
+
+    cout << "Assignment cost (ns per s2 = s1):\n";
+    cout << "depth       copy-on-write   deep copy\n";
+    const size_t depths[] = {8, 1024, 64 * 1024, 1024 * 1024};
+    unsigned long checksum = 0;
+    for (size_t depth : depths)
+    {
+        stack cow;
+        copy_stack deep;
+        fill(cow, depth);
+        fill(deep, depth);
+        size_t reps = depth >= 64 * 1024 ? 2000 : 200000;
+        double cow_ns = time_assign(cow, reps, checksum);
+        double deep_ns = time_assign(deep, reps, checksum);
+        cout << depth << "\t    " << cow_ns << "\t    " << deep_ns << "\n";
+    }
+
+    cout << "\nFirst write after a snapshot (ns):\n";
+    cout << "depth       first push      second push\n";
+    for (size_t depth : depths)
+    {
+        stack cow;
+        fill(cow, depth);
+        double first_ns, second_ns;
+        time_first_write(cow, depth >= 64 * 1024 ? 500 : 20000, first_ns, second_ns);
+        cout << depth << "\t    " << first_ns << "\t    " << second_ns << "\n";
+    }
+    cout << "(checksum " << checksum << ")\n";
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*
+5. The error in 3.cpp is that s2 = s1 copies the pointer p, so both objects end up pointing
+at the same memory and both destructors free it. One fix is a copy constructor and an
+assignment operator that allocate and copy the whole string every time. That is correct,
+but it makes every copy cost a malloc() and a strcpy().
+
+Here is a version of strtype in which the characters are immutable and shared. The memory
+block holds a reference count and the length in front of the characters. Copying or
+assigning a strtype only bumps the count, and the destructor only frees the block when
+the count drops to zero, so every block is freed exactly once. Since nobody can change
+the characters, sharing them is always safe. The count is atomic, so copies of one
+strtype can be handed to other threads.
+
+A move constructor and move assignment take the block over from the source without
+touching the count at all, and leave the source empty.
+
+main() reruns the program of 3.cpp, which now works, and times copies, assignments and
+moves against a strtype that deep-copies.
+
+Compile with optimization for meaningful timings:
+    g++ -std=c++17 -O2 5.cpp -o shared_strtype
+*/
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+class strtype
+{
+    struct block
+    {
+        atomic<long> refs; // number of strtype objects sharing this block
+        size_t len;
+        char data[1]; // really len + 1 characters long
+    };
+
+    block *p; // nullptr for an empty (or moved-from) string
+
+    void release();
+
+public:
+    strtype() : p(nullptr) {}
+    strtype(const char *ptr);
+    strtype(const strtype &other);
+    strtype(strtype &&other) noexcept;
+    ~strtype();
+    strtype &operator=(const strtype &other);
+    strtype &operator=(strtype &&other) noexcept;
+
+    void show() const;
+    const char *c_str() const { return p ? p->data : ""; }
+    size_t length() const { return p ? p->len : 0; }
+    long use_count() const { return p ? p->refs.load(memory_order_relaxed) : 0; }
+};
+
+strtype::strtype(const char *ptr)
+{
+    size_t len = strlen(ptr);
+    p = (block *)malloc(offsetof(block, data) + len + 1);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    new (&p->refs) atomic<long>(1);
+    p->len = len;
+    memcpy(p->data, ptr, len + 1);
+}
+
+strtype::strtype(const strtype &other) : p(other.p)
+{
+    // A new reference can only be made from an existing one, so relaxed is enough here.
+    if (p)
+        p->refs.fetch_add(1, memory_order_relaxed);
+}
+
+strtype::strtype(strtype &&other) noexcept : p(other.p)
+{
+    other.p = nullptr;
+}
+
+// Drop this object's reference; the last one out frees the block.
+void strtype::release()
+{
+    if (p && p->refs.fetch_sub(1, memory_order_acq_rel) == 1)
+        free(p);
+    p = nullptr;
+}
+
+strtype::~strtype()
+{
+    release();
+}
+
+strtype &strtype::operator=(const strtype &other)
+{
+    if (other.p)
+        other.p->refs.fetch_add(1, memory_order_relaxed); // before release(), so s = s is safe
+    release();
+    p = other.p;
+    return *this;
+}
+
+strtype &strtype::operator=(strtype &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        p = other.p;
+        other.p = nullptr;
+    }
+    return *this;
+}
+
+void strtype::show() const
+{
+    cout << c_str() << " - length : " << length();
+    cout << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// The naive fix for 3.cpp: every copy and assignment allocates and copies.
+class deep_strtype
+{
+    char *p;
+    size_t len;
+
+    void copy_from(const char *ptr, size_t n)
+    {
+        len = n;
+        p = (char *)malloc(n + 1);
+        if (!p)
+        {
+            cout << " Allocation error \n";
+            exit(1);
+        }
+        memcpy(p, ptr, n + 1);
+    }
+
+public:
+    deep_strtype(const char *ptr) { copy_from(ptr, strlen(ptr)); }
+    deep_strtype(const deep_strtype &other) { copy_from(other.p, other.len); }
+    deep_strtype(deep_strtype &&other) noexcept : p(other.p), len(other.len)
+    {
+        other.p = nullptr;
+        other.len = 0;
+    }
+    ~deep_strtype() { free(p); }
+    deep_strtype &operator=(const deep_strtype &other)
+    {
+        if (this != &other)
+        {
+            free(p);
+            copy_from(other.p, other.len);
+        }
+        return *this;
+    }
+    deep_strtype &operator=(deep_strtype &&other) noexcept
+    {
+        if (this != &other)
+        {
+            free(p);
+            p = other.p;
+            len = other.len;
+            other.p = nullptr;
+            other.len = 0;
+        }
+        return *this;
+    }
+    size_t length() const { return len; }
+};
+
+// Nanoseconds per copy construction, per assignment and per move of a string of length n.
+template <class String>
+void time_copies(size_t n, size_t reps, double &copy_ns, double &assign_ns, double &move_ns, size_t &checksum)
+{
+    string text(n, 'x');
+    String source(text.c_str());
+    String target("");
+
+    auto t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < reps; i++)
+    {
+        String copy(source);
+        checksum += copy.length();
+    }
+    auto t1 = chrono::steady_clock::now();
+    for (size_t i = 0; i < reps; i++)
+    {
+        target = source;
+        checksum += target.length();
+    }
+    auto t2 = chrono::steady_clock::now();
+    for (size_t i = 0; i < reps; i++)
+    {
+        String moved(std::move(source));
+        checksum += moved.length();
+        source = std::move(moved);
+    }
+    auto t3 = chrono::steady_clock::now();
+
+    copy_ns = chrono::duration<double, nano>(t1 - t0).count() / reps;
+    assign_ns = chrono::duration<double, nano>(t2 - t1).count() / reps;
+    move_ns = chrono::duration<double, nano>(t3 - t2).count() / reps;
+}
+
+int main()
+{
+    strtype s1(" This is a test ."), s2("I like C++. ");
+
+    s1.show();
+    s2.show();
+    // assign s1 to s2 - - this no longer double-frees
+    s2 = s1;
+    s1.show();
+    s2.show();
+    cout << "s1 and s2 share one buffer, use count " << s1.use_count() << "\n";
+
+    strtype s3(std::move(s1));
+    cout << "After moving s1 into s3, s1 is \"" << s1.c_str() << "\" and the use count is still "
+         << s3.use_count() << "\n\n";
+
+    const size_t lengths[] = {16, 256, 4096};
+    const size_t reps = 2000000;
+    size_t checksum = 0;
+    cout << "ns per operation     copy     assign   move\n";
+    for (size_t n : lengths)
+    {
+        double deep_copy, deep_assign, deep_move, shared_copy, shared_assign, shared_move;
+        time_copies<deep_strtype>(n, reps, deep_copy, deep_assign, deep_move, checksum);
+        time_copies<strtype>(n, reps, shared_copy, shared_assign, shared_move, checksum);
+        cout << n << " chars, deep copy   " << deep_copy << "\t" << deep_assign << "\t" << deep_move << "\n";
+        cout << n << " chars, shared      " << shared_copy << "\t" << shared_assign << "\t" << shared_move
+             << "\n";
+    }
+    cout << "(checksum " << checksum << ")\n";
+    return 0;
+}
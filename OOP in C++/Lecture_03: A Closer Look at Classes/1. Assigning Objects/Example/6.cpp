@@ -0,0 +1,323 @@
+/*
+6. Comparing two strtype objects from 3.cpp means comparing their p buffers character by
+character with strcmp(). When a program holds millions of strings but only a few
+thousand distinct values (names, categories, ...), it stores the same characters over
+and over and keeps comparing them.
+
+This program adds string interning. A global intern_table keeps exactly one copy of
+every distinct string, together with its hash. An interned handle is just a pointer to
+that copy, so:
+    - two handles are equal exactly when their pointers are equal (one comparison),
+    - hash() is read from the table entry instead of being computed,
+    - each record stores 8 bytes instead of its own copy of the characters.
+Interning is opt-in: strtype keeps its own characters, and strtype::intern() returns
+the handle when it is needed.
+
+The table is split into 64 shards, each a small open-addressing hash table with its own
+mutex, so threads interning different strings rarely wait for each other. lookup-or-
+insert is therefore thread-safe. Interned strings live until the program ends.
+
+main() builds a dataset with many duplicates and reports the memory saved and the
+comparison and hashing throughput of strtype against interned handles.
+
+Compile with:
+    g++ -std=c++17 -O2 -pthread 6.cpp -o intern
+*/
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// 64-bit FNV-1a hash of n characters.
+uint64_t hash_chars(const char *s, size_t n)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// The single copy of one distinct string.
+struct intern_entry
+{
+    uint64_t hash;
+    size_t len;
+    char data[1]; // really len + 1 characters long
+};
+
+// Declare a global table of distinct strings.
+class intern_table
+{
+    static const unsigned SHARDS = 64;
+
+    struct shard
+    {
+        mutex lock;
+        vector<intern_entry *> slots; // open addressing, power-of-two size, nullptr = empty
+        size_t count = 0;
+        size_t bytes = 0;
+    };
+
+    shard shards[SHARDS];
+
+    static void insert_slot(vector<intern_entry *> &slots, intern_entry *e);
+    intern_table() {}
+
+public:
+    static intern_table &instance();
+    const intern_entry *lookup_or_insert(const char *s, size_t len);
+    size_t size();
+    size_t bytes(); // bytes held by entries
+};
+
+intern_table &intern_table::instance()
+{
+    static intern_table table; // constructed once, thread-safely
+    return table;
+}
+
+void intern_table::insert_slot(vector<intern_entry *> &slots, intern_entry *e)
+{
+    size_t mask = slots.size() - 1;
+    size_t i = (e->hash >> 6) & mask; // the low 6 bits already chose the shard
+    while (slots[i])
+        i = (i + 1) & mask;
+    slots[i] = e;
+}
+
+const intern_entry *intern_table::lookup_or_insert(const char *s, size_t len)
+{
+    uint64_t h = hash_chars(s, len);
+    shard &sh = shards[h % SHARDS];
+    lock_guard<mutex> guard(sh.lock);
+
+    if (!sh.slots.empty())
+    {
+        size_t mask = sh.slots.size() - 1;
+        for (size_t i = (h >> 6) & mask; sh.slots[i]; i = (i + 1) & mask)
+        {
+            intern_entry *e = sh.slots[i];
+            if (e->hash == h && e->len == len && memcmp(e->data, s, len) == 0)
+                return e;
+        }
+    }
+
+    // Not found: make the one copy, growing the shard to keep it at most half full.
+    if (2 * (sh.count + 1) > sh.slots.size())
+    {
+        vector<intern_entry *> bigger(sh.slots.empty() ? 64 : sh.slots.size() * 2, nullptr);
+        for (intern_entry *old : sh.slots)
+            if (old)
+                insert_slot(bigger, old);
+        sh.slots.swap(bigger);
+    }
+    size_t size = offsetof(intern_entry, data) + len + 1;
+    intern_entry *e = (intern_entry *)malloc(size);
+    if (!e)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    e->hash = h;
+    e->len = len;
+    memcpy(e->data, s, len);
+    e->data[len] = '\0';
+    insert_slot(sh.slots, e);
+    sh.count++;
+    sh.bytes += size;
+    return e;
+}
+
+size_t intern_table::size()
+{
+    size_t n = 0;
+    for (shard &sh : shards)
+    {
+        lock_guard<mutex> guard(sh.lock);
+        n += sh.count;
+    }
+    return n;
+}
+
+size_t intern_table::bytes()
+{
+    size_t n = 0;
+    for (shard &sh : shards)
+    {
+        lock_guard<mutex> guard(sh.lock);
+        n += sh.bytes + sh.slots.size() * sizeof(intern_entry *);
+    }
+    return n;
+}
+
+// A handle to an interned string: one pointer, compared by address.
+class interned
+{
+    const intern_entry *e;
+
+public:
+    interned(const char *s) : e(intern_table::instance().lookup_or_insert(s, strlen(s))) {}
+    interned(const char *s, size_t len) : e(intern_table::instance().lookup_or_insert(s, len)) {}
+    bool operator==(const interned &other) const { return e == other.e; }
+    bool operator!=(const interned &other) const { return e != other.e; }
+    uint64_t hash() const { return e->hash; }
+    const char *c_str() const { return e->data; }
+    size_t length() const { return e->len; }
+};
+
+namespace std
+{
+template <>
+struct hash<interned>
+{
+    size_t operator()(const interned &s) const { return size_t(s.hash()); }
+};
+} // namespace std
+
+// The strtype of 3.cpp, with copying fixed and an equality test.
+class strtype
+{
+    char *p;
+    int len;
+
+    void copy_from(const char *ptr)
+    {
+        len = strlen(ptr);
+        p = (char *)malloc(len + 1);
+        if (!p)
+        {
+            cout << " Allocation error \n";
+            exit(1);
+        }
+        strcpy(p, ptr);
+    }
+
+public:
+    strtype(const char *ptr) { copy_from(ptr); }
+    strtype(const strtype &other) { copy_from(other.p); }
+    ~strtype() { free(p); }
+    strtype &operator=(const strtype &other)
+    {
+        if (this != &other)
+        {
+            free(p);
+            copy_from(other.p);
+        }
+        return *this;
+    }
+    bool operator==(const strtype &other) const { return strcmp(p, other.p) == 0; }
+    const char *c_str() const { return p; }
+    int length() const { return len; }
+    interned intern() const { return interned(p, len); } // opt-in interning
+    void show() const
+    {
+        cout << p << " - length : " << len;
+        cout << "\n";
+    }
+};
+
+struct strtype_hash
+{
+    size_t operator()(const strtype &s) const { return size_t(hash_chars(s.c_str(), s.length())); }
+};
+
+int main()
+{
+    strtype s1("electronics"), s2("electronics");
+    interned i1 = s1.intern(), i2 = s2.intern();
+    cout << "s1 and s2 have different buffers: " << (s1.c_str() != s2.c_str() ? "yes" : "no") << "\n";
+    cout << "their interned handles share one: " << (i1.c_str() == i2.c_str() ? "yes" : "no") << "\n\n";
+
+    // A dataset of 2M records drawn from 5000 distinct category names, skewed so a
+    // few categories are very common, as real data tends to be.
+    const size_t distinct = 5000, records = 2000000;
+    vector<string> names(distinct);
+    for (size_t i = 0; i < distinct; i++)
+        names[i] = "category/products/" + to_string(i * 7919 % 100000);
+    vector<size_t> pick(records);
+    uint64_t seed = 42;
+    for (size_t r = 0; r < records; r++)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        double u = double(seed >> 11) / double(1ull << 53);
+        pick[r] = size_t(u * u * distinct); // squaring skews toward small indices
+    }
+
+    vector<strtype> plain;
+    plain.reserve(records);
+    size_t plain_bytes = records * sizeof(strtype);
+    for (size_t r = 0; r < records; r++)
+    {
+        plain.emplace_back(names[pick[r]].c_str());
+        plain_bytes += names[pick[r]].size() + 1 + 16; // characters plus typical malloc() overhead
+    }
+
+    // Intern the records from four threads at once; all threads must get the same handles.
+    const unsigned threads = 4;
+    vector<vector<interned>> parts(threads);
+    vector<thread> workers;
+    auto t0 = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+            parts[t].reserve(records / threads + 1);
+            for (size_t r = t; r < records; r += threads)
+                parts[t].push_back(plain[r].intern());
+        });
+    for (auto &w : workers)
+        w.join();
+    auto t1 = chrono::steady_clock::now();
+    vector<interned> handles;
+    handles.reserve(records);
+    for (size_t r = 0; r < records; r++)
+        handles.push_back(parts[r % threads][r / threads]);
+
+    size_t table_size = intern_table::instance().size();
+    size_t interned_bytes = records * sizeof(interned) + intern_table::instance().bytes();
+    cout << records << " records, " << table_size << " distinct values\n";
+    cout << "  interning with " << threads << " threads: "
+         << chrono::duration<double, nano>(t1 - t0).count() / records << " ns/record\n";
+    cout << "  memory as strtype:  " << plain_bytes / 1024 << " KB\n";
+    cout << "  memory as interned: " << interned_bytes / 1024 << " KB (" << 100.0 - 100.0 * interned_bytes / plain_bytes
+         << "% saved)\n\n";
+
+    // Comparison throughput: compare every record with its neighbour.
+    size_t equal_plain = 0, equal_interned = 0;
+    auto c0 = chrono::steady_clock::now();
+    for (size_t r = 1; r < records; r++)
+        equal_plain += plain[r] == plain[r - 1];
+    auto c1 = chrono::steady_clock::now();
+    for (size_t r = 1; r < records; r++)
+        equal_interned += handles[r] == handles[r - 1];
+    auto c2 = chrono::steady_clock::now();
+    double cmp_plain = (records - 1) / chrono::duration<double>(c1 - c0).count() / 1e6;
+    double cmp_interned = (records - 1) / chrono::duration<double>(c2 - c1).count() / 1e6;
+    cout << "Comparisons (M/s):  strtype " << cmp_plain << ", interned " << cmp_interned
+         << (equal_plain == equal_interned ? "" : "  (RESULTS DIFFER)") << "\n";
+
+    // Hashing throughput: count records per category.
+    unordered_map<strtype, size_t, strtype_hash> by_plain;
+    unordered_map<interned, size_t> by_interned;
+    auto h0 = chrono::steady_clock::now();
+    for (const strtype &s : plain)
+        by_plain[s]++;
+    auto h1 = chrono::steady_clock::now();
+    for (const interned &s : handles)
+        by_interned[s]++;
+    auto h2 = chrono::steady_clock::now();
+    cout << "Group-by (M records/s):  strtype " << records / chrono::duration<double>(h1 - h0).count() / 1e6
+         << ", interned " << records / chrono::duration<double>(h2 - h1).count() / 1e6
+         << (by_plain.size() == by_interned.size() ? "" : "  (RESULTS DIFFER)") << "\n";
+    return 0;
+}
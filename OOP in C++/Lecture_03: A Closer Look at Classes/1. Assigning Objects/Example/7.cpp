@@ -0,0 +1,359 @@
+/*
+7. The strtype of 3.cpp can only be constructed and shown. Here is a version with search
+and replace:
+    find(needle, from)        position of the first match at or after from, or npos
+    contains(needle)          true if needle occurs at all
+    count_occurrences(needle) number of non-overlapping matches
+    replace_all(needle, with) replaces every non-overlapping match, returns the count
+(It also gets a copy constructor and assignment operator, so the bug in 3.cpp is gone.)
+
+find() picks an algorithm by needle length:
+  - Needles of up to 32 characters use a SIMD filter. For each position the CPU compares
+    the haystack byte with the first byte of the needle and the byte k-1 further on with
+    the last byte of the needle, 16 (SSE2) or 32 (AVX2) positions per instruction. Only
+    positions where both match are checked with memcmp(). Whether AVX2 is available is
+    asked once at run time; on CPUs that are not x86 a scalar loop using memchr() is
+    used instead.
+  - Longer needles use Boyer-Moore-Horspool, which skips ahead by up to the needle
+    length after every mismatch.
+
+main() compares find() with strstr() and std::string::find on haystacks from 1 MB up
+to 256 MB. A larger maximum (in MB) can be given on the command line, e.g. 1024 for 1 GB.
+
+Compile and run with:
+    g++ -std=c++17 -O2 7.cpp -o strtype_search
+    ./strtype_search [max_megabytes]
+*/
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STRTYPE_X86 1
+#endif
+using namespace std;
+
+typedef size_t (*find_function)(const char *s, size_t n, const char *needle, size_t k);
+
+// Scalar search for short needles: memchr() finds candidates for the first byte.
+size_t find_scalar(const char *s, size_t n, const char *needle, size_t k)
+{
+    if (n < k)
+        return SIZE_MAX;
+    const char *p = s;
+    const char *last_start = s + n - k;
+    while (p <= last_start)
+    {
+        p = (const char *)memchr(p, needle[0], last_start - p + 1);
+        if (!p)
+            break;
+        if (p[k - 1] == needle[k - 1] && (k <= 2 || memcmp(p + 1, needle + 1, k - 2) == 0))
+            return p - s;
+        p++;
+    }
+    return SIZE_MAX;
+}
+
+#ifdef STRTYPE_X86
+// SSE2 first/last-byte filter, 16 positions at a time.
+size_t find_sse2(const char *s, size_t n, const char *needle, size_t k)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(s + i + k - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask)
+        {
+            unsigned bit = __builtin_ctz(mask);
+            if (k <= 2 || memcmp(s + i + bit + 1, needle + 1, k - 2) == 0)
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = find_scalar(s + i, n - i, needle, k);
+    return rest == SIZE_MAX ? SIZE_MAX : i + rest;
+}
+
+// The same filter with AVX2, 32 positions at a time. Compiled for AVX2 even when the
+// rest of the program is not, and only called after checking that the CPU has it.
+__attribute__((target("avx2"))) size_t find_avx2(const char *s, size_t n, const char *needle, size_t k)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 32 <= n; i += 32)
+    {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(s + i + k - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (mask)
+        {
+            unsigned bit = __builtin_ctz(mask);
+            if (k <= 2 || memcmp(s + i + bit + 1, needle + 1, k - 2) == 0)
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = find_sse2(s + i, n - i, needle, k);
+    return rest == SIZE_MAX ? SIZE_MAX : i + rest;
+}
+#endif
+
+// Boyer-Moore-Horspool for long needles.
+size_t find_horspool(const char *s, size_t n, const char *needle, size_t k)
+{
+    size_t shift[256];
+    for (size_t c = 0; c < 256; c++)
+        shift[c] = k;
+    for (size_t i = 0; i + 1 < k; i++)
+        shift[(unsigned char)needle[i]] = k - 1 - i;
+
+    unsigned char last = (unsigned char)needle[k - 1];
+    for (size_t i = 0; i + k <= n;)
+    {
+        unsigned char c = (unsigned char)s[i + k - 1];
+        if (c == last && memcmp(s + i, needle, k - 1) == 0)
+            return i;
+        i += shift[c];
+    }
+    return SIZE_MAX;
+}
+
+// Choose the short-needle search once, based on what this CPU supports.
+find_function pick_short_find()
+{
+#ifdef STRTYPE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return find_avx2;
+    return find_sse2;
+#else
+    return find_scalar;
+#endif
+}
+
+const char *short_find_name()
+{
+    find_function f = pick_short_find();
+#ifdef STRTYPE_X86
+    if (f == find_avx2)
+        return "AVX2";
+    if (f == find_sse2)
+        return "SSE2";
+#endif
+    return f == find_scalar ? "scalar" : "unknown";
+}
+
+class strtype
+{
+    char *p;
+    size_t len;
+
+    static const size_t SIMD_MAX_NEEDLE = 32;
+    void copy_from(const char *ptr, size_t n);
+
+public:
+    static const size_t npos = SIZE_MAX;
+
+    strtype(const char *ptr);
+    strtype(const char *ptr, size_t n);
+    strtype(const strtype &other);
+    ~strtype();
+    strtype &operator=(const strtype &other);
+
+    size_t find(const char *needle, size_t from = 0) const;
+    bool contains(const char *needle) const { return find(needle) != npos; }
+    size_t count_occurrences(const char *needle) const;
+    size_t replace_all(const char *needle, const char *with);
+
+    void show() const;
+    const char *c_str() const { return p; }
+    size_t length() const { return len; }
+};
+
+void strtype::copy_from(const char *ptr, size_t n)
+{
+    len = n;
+    p = (char *)malloc(len + 1);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    memcpy(p, ptr, len);
+    p[len] = '\0';
+}
+
+strtype::strtype(const char *ptr)
+{
+    copy_from(ptr, strlen(ptr));
+}
+
+strtype::strtype(const char *ptr, size_t n)
+{
+    copy_from(ptr, n);
+}
+
+strtype::strtype(const strtype &other)
+{
+    copy_from(other.p, other.len);
+}
+
+strtype::~strtype()
+{
+    free(p);
+}
+
+strtype &strtype::operator=(const strtype &other)
+{
+    if (this != &other)
+    {
+        free(p);
+        copy_from(other.p, other.len);
+    }
+    return *this;
+}
+
+size_t strtype::find(const char *needle, size_t from) const
+{
+    static const find_function short_find = pick_short_find();
+
+    size_t k = strlen(needle);
+    if (from > len)
+        return npos;
+    if (k == 0)
+        return from;
+    if (k > len - from)
+        return npos;
+
+    size_t pos = k <= SIMD_MAX_NEEDLE ? short_find(p + from, len - from, needle, k)
+                                      : find_horspool(p + from, len - from, needle, k);
+    return pos == SIZE_MAX ? npos : from + pos;
+}
+
+size_t strtype::count_occurrences(const char *needle) const
+{
+    size_t k = strlen(needle);
+    if (k == 0)
+        return 0;
+    size_t count = 0;
+    for (size_t pos = find(needle); pos != npos; pos = find(needle, pos + k))
+        count++;
+    return count;
+}
+
+size_t strtype::replace_all(const char *needle, const char *with)
+{
+    size_t k = strlen(needle), w = strlen(with);
+    size_t count = count_occurrences(needle);
+    if (count == 0)
+        return 0;
+
+    // One allocation of the exact final size, then copy the pieces between matches.
+    size_t new_len = len - count * k + count * w;
+    char *out = (char *)malloc(new_len + 1);
+    if (!out)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    char *dst = out;
+    size_t prev = 0;
+    for (size_t pos = find(needle); pos != npos; pos = find(needle, pos + k))
+    {
+        memcpy(dst, p + prev, pos - prev);
+        dst += pos - prev;
+        memcpy(dst, with, w);
+        dst += w;
+        prev = pos + k;
+    }
+    memcpy(dst, p + prev, len - prev);
+    out[new_len] = '\0';
+
+    free(p);
+    p = out;
+    len = new_len;
+    return count;
+}
+
+void strtype::show() const
+{
+    cout << p << " - length : " << len;
+    cout << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// Best of three runs, so page faults and cold caches on the first pass do not count.
+template <class F>
+double gb_per_second(size_t bytes, F f)
+{
+    double best = 0;
+    for (int run = 0; run < 3; run++)
+    {
+        auto start = chrono::steady_clock::now();
+        f();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+    return bytes / best / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    strtype s1("I like C++. C++ is fast, and C++ is fun."), s2(s1);
+    cout << "find(\"C++\") = " << s1.find("C++") << ", count = " << s1.count_occurrences("C++")
+         << ", contains(\"Java\") = " << s1.contains("Java") << "\n";
+    s2.replace_all("C++", "the language");
+    s1.show();
+    s2.show();
+    cout << "Short needles use the " << short_find_name() << " search\n\n";
+
+    size_t max_mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 256;
+    const char *short_needle = "needle";
+    const char *long_needle = "a-much-longer-needle-that-goes-past-the-simd-filter-limit-of-32!";
+
+    cout << "GB/s                 strtype   strstr    std::string::find\n";
+    for (size_t mb = 1; mb <= max_mb; mb *= 4)
+    {
+        size_t n = mb << 20;
+        // Random lowercase text, with each needle planted once near the end.
+        string text(n, ' ');
+        uint32_t seed = 1;
+        for (size_t i = 0; i < n; i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            text[i] = char('a' + (seed >> 24) % 26);
+        }
+        memcpy(&text[n - 200], short_needle, strlen(short_needle));
+        memcpy(&text[n - 100], long_needle, strlen(long_needle));
+        strtype hay(text.data(), n);
+
+        const char *needles[] = {short_needle, long_needle};
+        const char *labels[] = {"short", "long "};
+        for (int which = 0; which < 2; which++)
+        {
+            const char *needle = needles[which];
+            size_t a = 0, b = 0, c = 0;
+            double ours = gb_per_second(n, [&] { a = hay.find(needle); });
+            double libc = gb_per_second(n, [&] { b = strstr(hay.c_str(), needle) - hay.c_str(); });
+            double stl = gb_per_second(n, [&] { c = text.find(needle); });
+            cout << mb << " MB " << labels[which] << " needle   " << ours << "\t" << libc << "\t" << stl
+                 << (a == b && b == c ? "" : "  (POSITIONS DIFFER)") << "\n";
+        }
+    }
+    return 0;
+}
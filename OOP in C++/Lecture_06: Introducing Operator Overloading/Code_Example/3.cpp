@@ -0,0 +1,463 @@
+/*
+3. The Matrix of 2.cpp is fixed at 2x2 doubles, with every operator unrolled by hand, and
+the integer Matrix of Exams/Lab/Practice Exam/Test/4.cpp repeats the same code for int.
+Here both become one class template:
+
+    template <class T, int Rows, int Cols> class Matrix
+
+The dimensions are template parameters, so they are known at compile time: a product
+of a 2x3 and a 3x4 matrix is a 2x4 matrix, and multiplying matrices whose sizes do not
+fit is a compile error instead of a wrong result. The constructors are constexpr, so a
+matrix can be a compile-time constant. The operators are those of 2.cpp: + - * == = []
+and prefix ++, plus print() (and display(), as in Test/4.cpp).
+
+Storage is aligned so that a row can be loaded with one SIMD instruction. A row of 3
+elements is padded to 4 (the extra element is always 0), which lets 3x3 matrices use the
+same 4-wide instructions as 4x4. For 2x2, 3x3 and 4x4 matrices of float, double and int,
++, - and * use SIMD code written with GCC's vector extensions: the compiler turns it into
+SSE or AVX instructions, whichever the target allows.
+  - + and - work on the whole matrix as one array of SIMD values.
+  - * computes each row of the result as a[i][0]*row0(b) + a[i][1]*row1(b) + ..., one
+    vector operation per term. A 2x2 product is done on whole matrices instead: two
+    shuffled copies of each operand, two multiplications and one addition.
+Every other size and element type uses plain loops.
+
+main() repeats the examples of 2.cpp and Test/4.cpp with the template, checks + and - on
+shapes that are not a whole number of SIMD values (3x3 float, 3x2 float, ...), then times ten
+million products (from a set of 4096 pairs that stays in the cache) against the original
+classes and against the plain loops.
+
+Compile with (add -march=native to let the compiler use AVX where the CPU has it):
+    g++ -std=c++17 -O2 3.cpp -o matrix_template
+    ./matrix_template [number_of_products]
+*/
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+// The widest SIMD value the compiler may use: 32 bytes with AVX, otherwise 16 (SSE).
+#ifdef __AVX__
+const size_t SIMD_BYTES = 32;
+#else
+const size_t SIMD_BYTES = 16;
+#endif
+
+// The largest power of two, at most limit, that divides bytes: the width of SIMD value
+// that steps through bytes exactly, with no part left over.
+constexpr size_t exact_step(size_t bytes, size_t limit)
+{
+    size_t step = limit;
+    while (step > 1 && bytes % step != 0)
+        step /= 2;
+    return step;
+}
+
+// Declare a matrix of Rows x Cols elements of type T.
+template <class T, int Rows, int Cols>
+class Matrix
+{
+    static_assert(Rows > 0 && Cols > 0, "a matrix needs at least one row and one column");
+
+public:
+    static constexpr int stride = Cols == 3 ? 4 : Cols; // elements per stored row
+    // True for the sizes and types that get SIMD code.
+    static constexpr bool simd = (is_same<T, float>::value || is_same<T, double>::value || is_same<T, int>::value) &&
+                                 (Cols == 2 || Cols == 3 || Cols == 4);
+
+private:
+    static constexpr size_t row_bytes = sizeof(T) * stride;
+    static constexpr size_t alignment = (row_bytes & (row_bytes - 1)) == 0 && row_bytes >= alignof(T) ? row_bytes
+                                                                                                       : alignof(T);
+    alignas(alignment) T data[Rows][stride];
+
+    template <class, int, int>
+    friend class Matrix;
+
+    // For results that the SIMD code overwrites completely, padding included.
+    struct no_init
+    {
+    };
+    explicit Matrix(no_init) {}
+
+    // A stored row is split into SIMD values of vector_bytes (only used when simd is true).
+    static constexpr size_t vector_bytes = !simd ? sizeof(T) : row_bytes < SIMD_BYTES ? row_bytes : SIMD_BYTES;
+    static constexpr int parts = int(row_bytes / vector_bytes);
+    static constexpr int lanes = int(vector_bytes / sizeof(T));
+    typedef T vector_type __attribute__((vector_size(vector_bytes)));
+
+    vector_type load(int i, int part) const
+    {
+        vector_type v;
+        memcpy(&v, &data[i][part * lanes], sizeof(v));
+        return v;
+    }
+    void store(int i, int part, vector_type v) { memcpy(&data[i][part * lanes], &v, sizeof(v)); }
+
+    // The stored rows follow each other without gaps, so + and - can treat the whole
+    // matrix as one array of SIMD values of flat_bytes each. flat_bytes divides total_bytes
+    // (a 3x3 float matrix is 48 bytes: three 16-byte values, not one and a half 32-byte ones).
+    static constexpr size_t total_bytes = Rows * row_bytes;
+    static constexpr size_t flat_bytes = !simd ? sizeof(T) : exact_step(total_bytes, SIMD_BYTES);
+    typedef T flat_type __attribute__((vector_size(flat_bytes)));
+
+    template <class Op>
+    Matrix elementwise(const Matrix &other, Op op) const
+    {
+        Matrix r{no_init()};
+        const char *x = (const char *)data, *y = (const char *)other.data;
+        char *z = (char *)r.data;
+        for (size_t off = 0; off < total_bytes; off += flat_bytes)
+        {
+            flat_type u, v;
+            memcpy(&u, x + off, flat_bytes);
+            memcpy(&v, y + off, flat_bytes);
+            u = op(u, v);
+            memcpy(z + off, &u, flat_bytes);
+        }
+        return r;
+    }
+
+public:
+    // All elements zero
+    constexpr Matrix() : data{} {}
+
+    // Elements row by row: Matrix<double, 2, 2> m{1, 2, 3, 4};
+    constexpr Matrix(initializer_list<T> values) : data{}
+    {
+        int k = 0;
+        for (T v : values)
+        {
+            if (k == Rows * Cols)
+                break;
+            data[k / Cols][k % Cols] = v;
+            k++;
+        }
+    }
+
+    // From a 2D array, as in Test/4.cpp
+    constexpr Matrix(const T (&m)[Rows][Cols]) : data{}
+    {
+        for (int i = 0; i < Rows; i++)
+            for (int j = 0; j < Cols; j++)
+                data[i][j] = m[i][j];
+    }
+
+    // Addition
+    Matrix operator+(const Matrix &other) const
+    {
+        if constexpr (simd)
+            return elementwise(other, [](flat_type u, flat_type v) { return u + v; });
+        Matrix r;
+        for (int i = 0; i < Rows; i++)
+            for (int j = 0; j < Cols; j++)
+                r.data[i][j] = data[i][j] + other.data[i][j];
+        return r;
+    }
+
+    // Subtraction
+    Matrix operator-(const Matrix &other) const
+    {
+        if constexpr (simd)
+            return elementwise(other, [](flat_type u, flat_type v) { return u - v; });
+        Matrix r;
+        for (int i = 0; i < Rows; i++)
+            for (int j = 0; j < Cols; j++)
+                r.data[i][j] = data[i][j] - other.data[i][j];
+        return r;
+    }
+
+    // Multiplication: (Rows x Cols) * (Cols x K) gives Rows x K
+    template <int K>
+    Matrix<T, Rows, K> operator*(const Matrix<T, Cols, K> &other) const
+    {
+        typedef Matrix<T, Cols, K> B;
+        if constexpr (B::simd && Rows == 2 && Cols == 2 && K == 2 && 4 * sizeof(T) <= SIMD_BYTES)
+        {
+            // A whole 2x2 matrix fits in one SIMD value: shuffle copies of a and b so that
+            // two multiplications and one addition give all four elements.
+            typedef T quad __attribute__((vector_size(4 * sizeof(T))));
+            typedef typename conditional<sizeof(T) == 8, long long, int>::type index;
+            typedef index quad_index __attribute__((vector_size(4 * sizeof(T))));
+            quad a, b;
+            memcpy(&a, data, sizeof(a));
+            memcpy(&b, other.data, sizeof(b));
+            quad r = __builtin_shuffle(a, quad_index{0, 0, 2, 2}) * __builtin_shuffle(b, quad_index{0, 1, 0, 1}) +
+                     __builtin_shuffle(a, quad_index{1, 1, 3, 3}) * __builtin_shuffle(b, quad_index{2, 3, 2, 3});
+            Matrix<T, 2, 2> result{typename Matrix<T, 2, 2>::no_init()};
+            memcpy(result.data, &r, sizeof(r));
+            return result;
+        }
+        else if constexpr (B::simd && Rows <= 4 && Cols <= 4)
+        {
+            typename B::vector_type b[Cols][B::parts];
+            for (int k = 0; k < Cols; k++)
+                for (int p = 0; p < B::parts; p++)
+                    b[k][p] = other.load(k, p);
+            Matrix<T, Rows, K> r{typename Matrix<T, Rows, K>::no_init()};
+            for (int i = 0; i < Rows; i++)
+                for (int p = 0; p < B::parts; p++)
+                {
+                    auto sum = data[i][0] * b[0][p]; // the scalar is broadcast to every lane
+                    for (int k = 1; k < Cols; k++)
+                        sum += data[i][k] * b[k][p];
+                    r.store(i, p, sum);
+                }
+            return r;
+        }
+        else
+            return multiply_loops(other);
+    }
+
+    // The plain triple loop, for any size; also used by main() for comparison.
+    template <int K>
+    Matrix<T, Rows, K> multiply_loops(const Matrix<T, Cols, K> &other) const
+    {
+        Matrix<T, Rows, K> r;
+        for (int i = 0; i < Rows; i++)
+            for (int j = 0; j < K; j++)
+            {
+                T sum = T();
+                for (int k = 0; k < Cols; k++)
+                    sum += data[i][k] * other.data[k][j];
+                r.data[i][j] = sum;
+            }
+        return r;
+    }
+
+    // Equality
+    bool operator==(const Matrix &other) const
+    {
+        for (int i = 0; i < Rows; i++)
+            for (int j = 0; j < Cols; j++)
+                if (data[i][j] != other.data[i][j])
+                    return false;
+        return true;
+    }
+
+    // Subscript (access row as array)
+    T *operator[](int index) { return data[index]; }
+    const T *operator[](int index) const { return data[index]; }
+
+    // Prefix Increment: add 1 to all elements
+    Matrix &operator++()
+    {
+        for (int i = 0; i < Rows; i++)
+            for (int j = 0; j < Cols; j++)
+                ++data[i][j];
+        return *this;
+    }
+
+    // Display
+    void print() const
+    {
+        for (int i = 0; i < Rows; i++)
+        {
+            for (int j = 0; j < Cols; j++)
+                cout << data[i][j] << " ";
+            cout << endl;
+        }
+    }
+    void display() const { print(); }
+};
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// The Matrix of 2.cpp, unchanged apart from the operators that are not timed.
+class Matrix2x2
+{
+    double data[2][2];
+
+public:
+    Matrix2x2(double a = 0, double b = 0, double c = 0, double d = 0)
+    {
+        data[0][0] = a; data[0][1] = b;
+        data[1][0] = c; data[1][1] = d;
+    }
+    Matrix2x2 operator*(const Matrix2x2 &other)
+    {
+        return Matrix2x2(
+            data[0][0] * other.data[0][0] + data[0][1] * other.data[1][0],
+            data[0][0] * other.data[0][1] + data[0][1] * other.data[1][1],
+            data[1][0] * other.data[0][0] + data[1][1] * other.data[1][0],
+            data[1][0] * other.data[0][1] + data[1][1] * other.data[1][1]);
+    }
+    double *operator[](int index) { return data[index]; }
+};
+
+// The integer Matrix of Test/4.cpp, with its by-value operator*.
+class IntMatrix2x2
+{
+    int mat[2][2];
+
+public:
+    IntMatrix2x2()
+    {
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                mat[i][j] = 0;
+    }
+    IntMatrix2x2(int a, int b, int c, int d)
+    {
+        mat[0][0] = a; mat[0][1] = b;
+        mat[1][0] = c; mat[1][1] = d;
+    }
+    IntMatrix2x2 operator*(IntMatrix2x2 m2)
+    {
+        IntMatrix2x2 temp;
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+            {
+                temp.mat[i][j] = 0;
+                for (int k = 0; k < 2; k++)
+                    temp.mat[i][j] += mat[i][k] * m2.mat[k][j];
+            }
+        return temp;
+    }
+    int *operator[](int index) { return mat[index]; }
+};
+
+// The matrices of a batch are kept in a working set of WORKING_SET entries that fits in
+// the cache, so the time is spent multiplying and not waiting for memory.
+const size_t WORKING_SET = 4096;
+
+// Time n products out[i] = a[i] * b[i], cycling through the working set; returns
+// nanoseconds per product.
+template <class M, class F>
+double time_batch(size_t n, vector<M> &a, vector<M> &b, vector<M> &out, F multiply)
+{
+    auto start = chrono::steady_clock::now();
+    for (size_t done = 0; done < n; done += WORKING_SET)
+        for (size_t i = 0; i < WORKING_SET; i++)
+            multiply(a[i], b[i], out[i]);
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / n;
+}
+
+template <class T, int N>
+void compare_sizes(size_t n, double &checksum)
+{
+    typedef Matrix<T, N, N> M;
+    vector<M> a(WORKING_SET), b(WORKING_SET), simd_out(WORKING_SET), loop_out(WORKING_SET);
+    unsigned seed = 12345;
+    for (size_t m = 0; m < WORKING_SET; m++)
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+            {
+                seed = seed * 1103515245u + 12345u;
+                a[m][i][j] = T((seed >> 16) % 7) - T(3);
+                b[m][i][j] = T((seed >> 8) % 5) - T(2);
+            }
+    double loops = time_batch(n, a, b, loop_out, [](const M &x, const M &y, M &r) { r = x.multiply_loops(y); });
+    double simd = time_batch(n, a, b, simd_out, [](const M &x, const M &y, M &r) { r = x * y; });
+    bool same = true;
+    for (size_t m = 0; m < WORKING_SET; m++)
+        same = same && simd_out[m] == loop_out[m];
+    checksum += double(simd_out[WORKING_SET / 2][0][0]);
+    cout << "  " << N << "x" << N << " " << (is_same<T, float>::value ? "float " : is_same<T, int>::value ? "int   " : "double")
+         << "   loops " << loops << " ns,  SIMD " << simd << " ns" << (same ? "" : "  (RESULTS DIFFER)") << "\n";
+}
+
+// Check + and - against element-by-element arithmetic. The odd shapes are the ones whose
+// size is not a whole number of SIMD values of the widest kind.
+template <class T, int Rows, int Cols>
+bool check_elementwise()
+{
+    Matrix<T, Rows, Cols> x, y;
+    for (int i = 0; i < Rows; i++)
+        for (int j = 0; j < Cols; j++)
+        {
+            x[i][j] = T(3 * i + j + 1);
+            y[i][j] = T(i - 2 * j);
+        }
+    Matrix<T, Rows, Cols> sum = x + y, difference = x - y;
+    for (int i = 0; i < Rows; i++)
+        for (int j = 0; j < Cols; j++)
+            if (sum[i][j] != x[i][j] + y[i][j] || difference[i][j] != x[i][j] - y[i][j])
+                return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // The example of 2.cpp
+    Matrix<double, 2, 2> m1{1, 2, 3, 4};
+    Matrix<double, 2, 2> m2{5, 6, 7, 8};
+    cout << "m1 + m2:" << endl; (m1 + m2).print();
+    cout << "m2 - m1:" << endl; (m2 - m1).print();
+    cout << "m1 * m2:" << endl; (m1 * m2).print();
+    ++m1;
+    cout << "++m1:" << endl; m1.print();
+    cout << "m1 == m2? " << (m1 == m2) << endl;
+    m1 = m2;
+    cout << "Access element m1[1][0]: " << m1[1][0] << endl;
+
+    // The example of Test/4.cpp
+    int a[2][2] = {{1, 2}, {3, 4}};
+    int b[2][2] = {{2, 0}, {1, 2}};
+    Matrix<int, 2, 2> i1(a), i2(b);
+    cout << "Product of matrices:\n";
+    (i1 * i2).display();
+
+    // Sizes need not match, as long as the product is defined.
+    constexpr Matrix<int, 2, 3> p{1, 2, 3, 4, 5, 6};
+    constexpr Matrix<int, 3, 1> q{1, 0, -1};
+    cout << "2x3 times 3x1:\n";
+    (p * q).print();
+
+    bool elementwise_ok = check_elementwise<float, 3, 3>() && check_elementwise<float, 3, 2>() &&
+                          check_elementwise<float, 1, 3>() && check_elementwise<double, 3, 3>() &&
+                          check_elementwise<double, 5, 2>() && check_elementwise<int, 3, 4>() &&
+                          check_elementwise<int, 7, 3>();
+    cout << "+ and - on odd shapes: " << (elementwise_ok ? "correct" : "WRONG") << "\n\n";
+
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+    double checksum = 0;
+
+    // Against the original classes
+    {
+        const size_t w = WORKING_SET;
+        vector<Matrix2x2> oa(w), ob(w), oc(w);
+        vector<IntMatrix2x2> ia(w), ib(w), ic(w);
+        vector<Matrix<double, 2, 2>> ta(w), tb(w), tc(w);
+        vector<Matrix<int, 2, 2>> ua(w), ub(w), uc(w);
+        for (size_t m = 0; m < w; m++)
+        {
+            int v = int(m % 13);
+            oa[m] = Matrix2x2(v, 1, 2, v + 1);
+            ob[m] = Matrix2x2(1, v, v - 1, 2);
+            ta[m] = Matrix<double, 2, 2>{double(v), 1, 2, double(v + 1)};
+            tb[m] = Matrix<double, 2, 2>{1, double(v), double(v - 1), 2};
+            ia[m] = IntMatrix2x2(v, 1, 2, v + 1);
+            ib[m] = IntMatrix2x2(1, v, v - 1, 2);
+            ua[m] = Matrix<int, 2, 2>{v, 1, 2, v + 1};
+            ub[m] = Matrix<int, 2, 2>{1, v, v - 1, 2};
+        }
+        double t_old = time_batch(n, oa, ob, oc, [](Matrix2x2 &x, Matrix2x2 &y, Matrix2x2 &r) { r = x * y; });
+        double t_new = time_batch(n, ta, tb, tc, [](const auto &x, const auto &y, auto &r) { r = x * y; });
+        double t_iold = time_batch(n, ia, ib, ic, [](IntMatrix2x2 &x, IntMatrix2x2 &y, IntMatrix2x2 &r) { r = x * y; });
+        double t_inew = time_batch(n, ua, ub, uc, [](const auto &x, const auto &y, auto &r) { r = x * y; });
+        checksum += oc[w / 3][1][1] + tc[w / 3][1][1] + ic[w / 3][1][1] + uc[w / 3][1][1];
+        cout << n << " products, ns per product:\n";
+        cout << "  2x2 double   2.cpp " << t_old << " ns,  template " << t_new << " ns\n";
+        cout << "  2x2 int      Test/4.cpp " << t_iold << " ns,  template " << t_inew << " ns\n";
+    }
+
+    // Plain loops against the SIMD code, for every specialized size and type
+    compare_sizes<float, 2>(n, checksum);
+    compare_sizes<float, 3>(n, checksum);
+    compare_sizes<float, 4>(n, checksum);
+    compare_sizes<double, 2>(n, checksum);
+    compare_sizes<double, 3>(n, checksum);
+    compare_sizes<double, 4>(n, checksum);
+    compare_sizes<int, 2>(n, checksum);
+    compare_sizes<int, 3>(n, checksum);
+    compare_sizes<int, 4>(n, checksum);
+    cout << "(checksum " << checksum << ")\n";
+    return 0;
+}
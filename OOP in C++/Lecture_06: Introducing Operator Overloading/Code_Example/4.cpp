@@ -0,0 +1,1014 @@
+/*
+4. The operator* of Exams/Lab/Practice Exam/Test/4.cpp is the textbook triple loop
+        for i, for j, for k:  c[i][j] += a[i][k] * b[k][j]
+and it takes its argument by value. For 2x2 that is fine. For 2000x2000 matrices the
+loop over k walks down a column of b, touching a new cache line (and soon a new page)
+at every step, so the processor spends nearly all its time waiting for memory.
+
+This program has a Matrix whose size is chosen at run time: rows x cols doubles, stored
+row by row in memory aligned to 64 bytes (one cache line). Its operator* uses the
+blocked algorithm of fast linear algebra libraries (Goto's algorithm):
+  - The product is computed in blocks chosen to fit the caches: a KC x NC panel of b
+    (kept in L3), an MC x KC block of a (kept in L2), and a KC x NR sliver of b that
+    stays in L1 while it is used against every row of the block of a.
+  - Before use, each block is packed: copied into a buffer in exactly the order the
+    inner loop reads it, so every load is sequential. Packing also pads the edges
+    with zeros, so the inner loop never needs a special case.
+  - The inner loop, the microkernel, computes an MR x NR tile of c held entirely in SIMD
+    registers: per step of k it loads one row of the b sliver, broadcasts each of the
+    MR elements of a, and does MR x NR multiply-adds with fused multiply-add (FMA)
+    instructions. There are two versions, 6x8 for AVX2 and 6x16 for AVX-512, picked at
+    run time from what the CPU supports, and a plain C++ version for other CPUs.
+
+Large products are also split across threads. The threads belong to a pool that is
+created once and kept, so a product does not pay for starting threads. The result matrix
+is divided into a grid of blocks, one per thread, as close to square as the thread count
+allows; each thread packs its own panels and reuses them for its whole block. The grid
+lines fall on multiples of the microkernel tile, so threads never write the same tile.
+set_gemm_threads(n) chooses the number of threads (all cores by default), and products
+of fewer than 96^3 multiply-adds always run on one thread. The pool runs one product at
+a time: operator* may still be called from several threads at once, and a product that
+finds the pool busy runs on its own thread.
+
+For very large products, set_gemm_algorithm(GEMM_STRASSEN) switches operator* to
+Strassen-Winograd: a product is split into quarters and computed with 7 products of
+half the size instead of 8, recursively, so n^2.81 instead of n^3 work. Below a
+crossover size the extra additions cost more than the saved product, and the blocked
+product is used; calibrate_strassen_crossover() measures that size on the machine.
+Both settings may be changed while other threads multiply: a product reads them once,
+when it starts.
+  - Odd sizes are not padded: the even part is split, and the last row, column or
+    term of the sum is added with the blocked product. No extra memory is needed.
+  - Scratch memory (two quarter-size blocks per level, a third of the size of the
+    inputs in total) is allocated once per product and shared by all the products of
+    each level.
+  - Rounding errors are larger than those of the classic product, because the
+    additions of the quarters mix elements of different sizes; main() reports by how
+    much.
+
+main() measures the machine's peak (FMA instructions with no memory access at all) and
+reports GFLOP/s (2*n^3 floating-point operations per product) on one thread for the
+blocked product and the naive loop. The naive loop is only run up to n = 1024 unless a
+larger limit is given on the command line, because at n = 2048 it takes minutes. Then
+it reports strong scaling, from one thread to all cores, for n = 1024, 2048 and 4096
+(the largest n can be given as the second argument), and finally calibrates the
+Strassen-Winograd crossover and compares its time and accuracy with the blocked product.
+
+Compile and run with:
+    g++ -std=c++17 -O2 -pthread 4.cpp -o blocked_gemm
+    ./blocked_gemm [max_naive_n] [max_scaling_n]
+*/
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATRIX_X86 1
+#endif
+using namespace std;
+
+void *aligned_or_exit(size_t bytes)
+{
+    // aligned_alloc() needs a size that is a multiple of the alignment.
+    void *p = aligned_alloc(64, (bytes + 63) / 64 * 64 + 64);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    return p;
+}
+
+// Declare a dense matrix of doubles whose size is chosen at run time.
+class Matrix
+{
+    int nrows, ncols;
+    double *data; // row-major, 64-byte aligned
+
+public:
+    Matrix(int rows = 0, int cols = 0);
+    Matrix(const Matrix &other);
+    Matrix(Matrix &&other) noexcept;
+    ~Matrix() { free(data); }
+    Matrix &operator=(const Matrix &other);
+    Matrix &operator=(Matrix &&other) noexcept;
+
+    int rows() const { return nrows; }
+    int cols() const { return ncols; }
+    double *operator[](int row) { return data + size_t(row) * ncols; } // access row as array
+    const double *operator[](int row) const { return data + size_t(row) * ncols; }
+
+    Matrix operator+(const Matrix &other) const;
+    Matrix operator-(const Matrix &other) const;
+    Matrix operator*(const Matrix &other) const; // blocked, packed product
+    bool operator==(const Matrix &other) const;
+    Matrix &operator++();
+    void print() const;
+};
+
+Matrix::Matrix(int rows, int cols) : nrows(rows), ncols(cols)
+{
+    size_t bytes = size_t(rows) * cols * sizeof(double);
+    data = (double *)aligned_or_exit(bytes);
+    memset(data, 0, bytes);
+}
+
+Matrix::Matrix(const Matrix &other) : nrows(other.nrows), ncols(other.ncols)
+{
+    size_t bytes = size_t(nrows) * ncols * sizeof(double);
+    data = (double *)aligned_or_exit(bytes);
+    memcpy(data, other.data, bytes);
+}
+
+Matrix::Matrix(Matrix &&other) noexcept : nrows(other.nrows), ncols(other.ncols), data(other.data)
+{
+    other.nrows = other.ncols = 0;
+    other.data = nullptr;
+}
+
+Matrix &Matrix::operator=(const Matrix &other)
+{
+    if (this != &other)
+    {
+        Matrix copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Matrix &Matrix::operator=(Matrix &&other) noexcept
+{
+    if (this != &other)
+    {
+        free(data);
+        nrows = other.nrows;
+        ncols = other.ncols;
+        data = other.data;
+        other.nrows = other.ncols = 0;
+        other.data = nullptr;
+    }
+    return *this;
+}
+
+Matrix Matrix::operator+(const Matrix &other) const
+{
+    Matrix r(nrows, ncols);
+    for (size_t i = 0; i < size_t(nrows) * ncols; i++)
+        r.data[i] = data[i] + other.data[i];
+    return r;
+}
+
+Matrix Matrix::operator-(const Matrix &other) const
+{
+    Matrix r(nrows, ncols);
+    for (size_t i = 0; i < size_t(nrows) * ncols; i++)
+        r.data[i] = data[i] - other.data[i];
+    return r;
+}
+
+bool Matrix::operator==(const Matrix &other) const
+{
+    return nrows == other.nrows && ncols == other.ncols &&
+           memcmp(data, other.data, size_t(nrows) * ncols * sizeof(double)) == 0;
+}
+
+Matrix &Matrix::operator++()
+{
+    for (size_t i = 0; i < size_t(nrows) * ncols; i++)
+        ++data[i];
+    return *this;
+}
+
+void Matrix::print() const
+{
+    for (int i = 0; i < nrows; i++)
+    {
+        for (int j = 0; j < ncols; j++)
+            cout << (*this)[i][j] << " ";
+        cout << endl;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Blocked product
+// ---------------------------------------------------------------------------
+
+// Block sizes: a KC x NR sliver of b fits in L1, an MC x KC block of a in L2, and a
+// KC x NC panel of b in L3.
+const int KC = 256;
+const int MC = 192;
+const int NC = 4096;
+const int MR = 6; // rows of c per microkernel call, the same for every kernel
+
+// c[0..MR)[0..nr) += (packed a sliver) * (packed b sliver) over kc steps, where
+// ldc is the distance between rows of c.
+typedef void (*microkernel)(int kc, const double *a, const double *b, double *c, int ldc);
+
+// Plain C++, for CPUs without AVX2. NR = 8.
+void kernel_generic_6x8(int kc, const double *a, const double *b, double *c, int ldc)
+{
+    double acc[MR][8] = {};
+    for (int k = 0; k < kc; k++, a += MR, b += 8)
+        for (int i = 0; i < MR; i++)
+            for (int j = 0; j < 8; j++)
+                acc[i][j] += a[i] * b[j];
+    for (int i = 0; i < MR; i++)
+        for (int j = 0; j < 8; j++)
+            c[i * ldc + j] += acc[i][j];
+}
+
+#ifdef MATRIX_X86
+// AVX2 + FMA: 6 rows x 8 columns = 12 registers of 4 doubles. NR = 8.
+__attribute__((target("avx2,fma"))) void kernel_avx2_6x8(int kc, const double *a, const double *b, double *c,
+                                                         int ldc)
+{
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd(), c10 = _mm256_setzero_pd(),
+            c11 = _mm256_setzero_pd(), c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd(),
+            c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd(), c40 = _mm256_setzero_pd(),
+            c41 = _mm256_setzero_pd(), c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+    for (int k = 0; k < kc; k++, a += MR, b += 8)
+    {
+        __m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+        __m256d x = _mm256_broadcast_sd(a + 0);
+        c00 = _mm256_fmadd_pd(x, b0, c00);
+        c01 = _mm256_fmadd_pd(x, b1, c01);
+        x = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(x, b0, c10);
+        c11 = _mm256_fmadd_pd(x, b1, c11);
+        x = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(x, b0, c20);
+        c21 = _mm256_fmadd_pd(x, b1, c21);
+        x = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(x, b0, c30);
+        c31 = _mm256_fmadd_pd(x, b1, c31);
+        x = _mm256_broadcast_sd(a + 4);
+        c40 = _mm256_fmadd_pd(x, b0, c40);
+        c41 = _mm256_fmadd_pd(x, b1, c41);
+        x = _mm256_broadcast_sd(a + 5);
+        c50 = _mm256_fmadd_pd(x, b0, c50);
+        c51 = _mm256_fmadd_pd(x, b1, c51);
+    }
+    __m256d acc[MR][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    for (int i = 0; i < MR; i++)
+    {
+        double *row = c + i * ldc;
+        _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), acc[i][0]));
+        _mm256_storeu_pd(row + 4, _mm256_add_pd(_mm256_loadu_pd(row + 4), acc[i][1]));
+    }
+}
+
+// AVX-512: 6 rows x 16 columns = 12 registers of 8 doubles. NR = 16.
+__attribute__((target("avx512f"))) void kernel_avx512_6x16(int kc, const double *a, const double *b, double *c,
+                                                           int ldc)
+{
+    __m512d acc[MR][2];
+    for (int i = 0; i < MR; i++)
+        acc[i][0] = acc[i][1] = _mm512_setzero_pd();
+    for (int k = 0; k < kc; k++, a += MR, b += 16)
+    {
+        __m512d b0 = _mm512_load_pd(b), b1 = _mm512_load_pd(b + 8);
+        for (int i = 0; i < MR; i++) // unrolled by the compiler; acc stays in registers
+        {
+            __m512d x = _mm512_set1_pd(a[i]);
+            acc[i][0] = _mm512_fmadd_pd(x, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_pd(x, b1, acc[i][1]);
+        }
+    }
+    for (int i = 0; i < MR; i++)
+    {
+        double *row = c + i * ldc;
+        _mm512_storeu_pd(row, _mm512_add_pd(_mm512_loadu_pd(row), acc[i][0]));
+        _mm512_storeu_pd(row + 8, _mm512_add_pd(_mm512_loadu_pd(row + 8), acc[i][1]));
+    }
+}
+#endif
+
+struct gemm_kernel
+{
+    microkernel run;
+    int nr; // columns of c per call
+    const char *name;
+};
+
+// Choose the microkernel once, based on what this CPU supports.
+gemm_kernel pick_kernel()
+{
+#ifdef MATRIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return {kernel_avx512_6x16, 16, "AVX-512 6x16"};
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return {kernel_avx2_6x8, 8, "AVX2+FMA 6x8"};
+#endif
+    return {kernel_generic_6x8, 8, "generic 6x8"};
+}
+
+const gemm_kernel &active_kernel()
+{
+    static const gemm_kernel k = pick_kernel();
+    return k;
+}
+
+// Pack an mc x kc block of a (row stride lda) into slivers of MR rows: for each sliver,
+// column after column, MR values each. Missing rows at the bottom are zeros.
+void pack_a(int mc, int kc, const double *a, int lda, double *out)
+{
+    for (int i0 = 0; i0 < mc; i0 += MR)
+    {
+        int rows = min(MR, mc - i0);
+        for (int k = 0; k < kc; k++)
+        {
+            for (int i = 0; i < rows; i++)
+                out[i] = a[size_t(i0 + i) * lda + k];
+            for (int i = rows; i < MR; i++)
+                out[i] = 0;
+            out += MR;
+        }
+    }
+}
+
+// Pack a kc x nc panel of b (row stride ldb) into slivers of nr columns: for each sliver,
+// row after row, nr values each. Missing columns at the right are zeros.
+void pack_b(int kc, int nc, int nr, const double *b, int ldb, double *out)
+{
+    for (int j0 = 0; j0 < nc; j0 += nr)
+    {
+        int cols = min(nr, nc - j0);
+        for (int k = 0; k < kc; k++)
+        {
+            const double *src = b + size_t(k) * ldb + j0;
+            for (int j = 0; j < cols; j++)
+                out[j] = src[j];
+            for (int j = cols; j < nr; j++)
+                out[j] = 0;
+            out += nr;
+        }
+    }
+}
+
+// c += a * b for an m x k matrix a and a k x n matrix b, all row-major.
+void gemm_blocked(int m, int n, int k, const double *a, int lda, const double *b, int ldb, double *c, int ldc)
+{
+    const gemm_kernel &kern = active_kernel();
+    const int nr = kern.nr;
+    int nc_max = min(NC, (n + nr - 1) / nr * nr);
+    double *packed_a = (double *)aligned_or_exit(sizeof(double) * MC * KC);
+    double *packed_b = (double *)aligned_or_exit(sizeof(double) * KC * nc_max);
+    double edge[MR * 16]; // a partial tile of c at the bottom or right edge
+
+    for (int jc = 0; jc < n; jc += NC)
+    {
+        int nc = min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC)
+        {
+            int kc = min(KC, k - pc);
+            pack_b(kc, nc, nr, b + size_t(pc) * ldb + jc, ldb, packed_b);
+            for (int ic = 0; ic < m; ic += MC)
+            {
+                int mc = min(MC, m - ic);
+                pack_a(mc, kc, a + size_t(ic) * lda + pc, lda, packed_a);
+                for (int jr = 0; jr < nc; jr += nr)
+                {
+                    int cols = min(nr, nc - jr);
+                    const double *bp = packed_b + size_t(jr) * kc;
+                    for (int ir = 0; ir < mc; ir += MR)
+                    {
+                        int rows = min(MR, mc - ir);
+                        const double *ap = packed_a + size_t(ir) * kc;
+                        double *ct = c + size_t(ic + ir) * ldc + jc + jr;
+                        if (rows == MR && cols == nr)
+                            kern.run(kc, ap, bp, ct, ldc);
+                        else
+                        {
+                            // Compute the full tile into edge, then add the part that exists.
+                            memset(edge, 0, sizeof(edge));
+                            kern.run(kc, ap, bp, edge, nr);
+                            for (int i = 0; i < rows; i++)
+                                for (int j = 0; j < cols; j++)
+                                    ct[size_t(i) * ldc + j] += edge[i * nr + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(packed_a);
+    free(packed_b);
+}
+
+// ---------------------------------------------------------------------------
+// Parallel product
+// ---------------------------------------------------------------------------
+
+// Declare a pool of threads that stay alive between products. run(n, f) calls f(0) ...
+// f(n-1) at the same time, f(0) on the calling thread, and returns when all are done.
+// The pool runs one job at a time: callers of run() must not overlap.
+class thread_pool
+{
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, done;
+    function<void(int)> job;
+    int job_threads;
+    long generation; // incremented for every job, so a worker never runs one twice
+    int remaining;   // workers that have not finished the current job
+    bool stopping;
+
+    void worker_loop(int id);
+
+public:
+    explicit thread_pool(int threads);
+    ~thread_pool();
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    int size() const { return int(workers.size()) + 1; }
+    void run(int threads, const function<void(int)> &f);
+};
+
+thread_pool::thread_pool(int threads) : job_threads(0), generation(0), remaining(0), stopping(false)
+{
+    for (int id = 1; id < threads; id++)
+        workers.emplace_back([this, id] { worker_loop(id); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread &t : workers)
+        t.join();
+}
+
+void thread_pool::worker_loop(int id)
+{
+    long seen = 0;
+    for (;;)
+    {
+        unique_lock<mutex> guard(lock);
+        wake.wait(guard, [&] { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        bool mine = id < job_threads;
+        guard.unlock();
+        if (mine)
+            job(id);
+        guard.lock();
+        if (--remaining == 0)
+            done.notify_one();
+    }
+}
+
+void thread_pool::run(int threads, const function<void(int)> &f)
+{
+    threads = max(1, min(threads, size()));
+    if (threads == 1)
+    {
+        f(0);
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        job = f;
+        job_threads = threads;
+        remaining = int(workers.size()); // every worker reports back, busy or not
+        generation++;
+    }
+    wake.notify_all();
+    f(0);
+    unique_lock<mutex> guard(lock);
+    done.wait(guard, [&] { return remaining == 0; });
+}
+
+// Products smaller than this many multiply-adds are not worth waking the pool for.
+const double PARALLEL_CUTOFF = 96.0 * 96 * 96;
+
+atomic<int> gemm_thread_count(max(1, int(thread::hardware_concurrency())));
+
+// operator* may be called from several threads at once, but the pool runs one job at a
+// time. Whoever holds gemm_pool_lock owns the pool (and may resize it); a product that
+// finds the pool busy runs on its own thread instead of waiting. That also covers a
+// product started from inside a pool job, which would otherwise wait for itself.
+mutex gemm_pool_lock;
+thread_local bool holds_gemm_pool = false;
+
+// Call only with gemm_pool_lock held.
+thread_pool &gemm_pool(int threads)
+{
+    static unique_ptr<thread_pool> pool;
+    if (!pool || pool->size() != threads)
+        pool.reset(new thread_pool(threads));
+    return *pool;
+}
+
+// Set the number of threads used by operator* (at least 1). Products already running
+// keep the count they started with.
+void set_gemm_threads(int threads)
+{
+    gemm_thread_count = max(1, threads);
+}
+
+// Split c into a grid of tile_rows x tile_cols blocks, one per thread. Each thread runs
+// the blocked product on its own block with its own packed panels, so the panel of b it
+// packs is reused for every block of a in its rows. Block edges are multiples of MR and
+// NR, so no microkernel tile is shared between threads.
+void gemm_parallel(int m, int n, int k, const double *a, int lda, const double *b, int ldb, double *c, int ldc)
+{
+    int threads = gemm_thread_count;
+    if (threads == 1 || double(m) * n * k < PARALLEL_CUTOFF)
+    {
+        gemm_blocked(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+    const int nr = active_kernel().nr;
+    int row_units = (m + MR - 1) / MR, col_units = (n + nr - 1) / nr;
+
+    // Choose the grid whose blocks are closest to square, with enough units per block.
+    int tile_rows = 1;
+    double best = 1e30;
+    for (int r = 1; r <= threads; r++)
+    {
+        if (threads % r || r > row_units || threads / r > col_units)
+            continue;
+        double shape = fabs(log((double(m) / r) / (double(n) / (threads / r))));
+        if (shape < best)
+        {
+            best = shape;
+            tile_rows = r;
+        }
+    }
+    int tile_cols = threads / tile_rows;
+    unique_lock<mutex> owner;
+    if (!holds_gemm_pool)
+        owner = unique_lock<mutex>(gemm_pool_lock, try_to_lock);
+    if (tile_rows > row_units || tile_cols > col_units || !owner.owns_lock()) // too small, or pool busy
+    {
+        gemm_blocked(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    holds_gemm_pool = true;
+    gemm_pool(threads).run(tile_rows * tile_cols, [&](int t) {
+        int tr = t / tile_cols, tc = t % tile_cols;
+        int i0 = row_units * tr / tile_rows * MR, i1 = min(m, row_units * (tr + 1) / tile_rows * MR);
+        int j0 = col_units * tc / tile_cols * nr, j1 = min(n, col_units * (tc + 1) / tile_cols * nr);
+        if (i0 < i1 && j0 < j1)
+            gemm_blocked(i1 - i0, j1 - j0, k, a + size_t(i0) * lda, lda, b + j0, ldb, c + size_t(i0) * ldc + j0, ldc);
+    });
+    holds_gemm_pool = false;
+}
+
+// ---------------------------------------------------------------------------
+// Strassen-Winograd product
+// ---------------------------------------------------------------------------
+
+enum gemm_algorithm
+{
+    GEMM_CLASSIC,  // the blocked product above, 2 n^3 operations
+    GEMM_STRASSEN, // Strassen-Winograd above the crossover, the blocked product below it
+};
+
+atomic<gemm_algorithm> gemm_mode(GEMM_CLASSIC);
+
+// Choose the algorithm used by operator*. Like set_strassen_crossover(), this is safe to
+// call while other threads multiply.
+void set_gemm_algorithm(gemm_algorithm algorithm)
+{
+    gemm_mode = algorithm;
+}
+
+const int STRASSEN_NEVER = 1 << 30;
+
+// A product is split by Strassen-Winograd when all three of its dimensions are at least
+// this large. calibrate_strassen_crossover() measures a value for the machine.
+atomic<int> strassen_crossover(1024);
+
+void set_strassen_crossover(int n)
+{
+    strassen_crossover = max(2, n);
+}
+
+bool strassen_splits(int m, int n, int k, int crossover)
+{
+    return min(m, min(n, k)) >= crossover;
+}
+
+// out = x + y and out = x - y on m x n blocks, each with its own row stride. out may be x
+// or y.
+void block_add(int m, int n, const double *x, int ldx, const double *y, int ldy, double *out, int ldo)
+{
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+            out[size_t(i) * ldo + j] = x[size_t(i) * ldx + j] + y[size_t(i) * ldy + j];
+}
+
+void block_sub(int m, int n, const double *x, int ldx, const double *y, int ldy, double *out, int ldo)
+{
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+            out[size_t(i) * ldo + j] = x[size_t(i) * ldx + j] - y[size_t(i) * ldy + j];
+}
+
+// c = a b with the blocked product (c is overwritten, not added to).
+void gemm_overwrite(int m, int n, int k, const double *a, int lda, const double *b, int ldb, double *c, int ldc)
+{
+    for (int i = 0; i < m; i++)
+        memset(c + size_t(i) * ldc, 0, n * sizeof(double));
+    gemm_parallel(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+// Doubles of scratch memory strassen_product() needs for an m x n x k product: two
+// quarter-size blocks for this level, and the scratch of one product of the level below.
+// The seven products of a level run one after another, so they all use the same space.
+size_t strassen_scratch(int m, int n, int k, int crossover)
+{
+    if (!strassen_splits(m, n, k, crossover))
+        return 0;
+    int m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    return size_t(m2) * max(k2, n2) + size_t(k2) * n2 + strassen_scratch(m2, n2, k2, crossover);
+}
+
+// c = a b (overwritten) by Strassen-Winograd: 7 products of half the size and 15
+// additions instead of 8 products, applied recursively down to the crossover. The order
+// of the steps is that of Boyer, Dumas, Pernet and Zhou ("Memory efficient scheduling of
+// Strassen-Winograd's matrix multiplication algorithm", 2009): besides the four quarters
+// of c it needs only two temporary blocks, x and y.
+//
+// Odd dimensions are not padded. The even part (m, n, k rounded down) is done by
+// Strassen-Winograd, and the rest with the blocked product: the last column of a times
+// the last row of b when k is odd, and the last column or row of c when n or m is odd.
+void strassen_product(int m, int n, int k, const double *a, int lda, const double *b, int ldb, double *c, int ldc,
+                      double *scratch, int crossover)
+{
+    if (!strassen_splits(m, n, k, crossover))
+    {
+        gemm_overwrite(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+    int m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    const double *a11 = a, *a12 = a + k2, *a21 = a + size_t(m2) * lda, *a22 = a21 + k2;
+    const double *b11 = b, *b12 = b + n2, *b21 = b + size_t(k2) * ldb, *b22 = b21 + n2;
+    double *c11 = c, *c12 = c + n2, *c21 = c + size_t(m2) * ldc, *c22 = c21 + n2;
+    double *x = scratch;                      // m2 x k2, later m2 x n2
+    double *y = x + size_t(m2) * max(k2, n2); // k2 x n2
+    double *deeper = y + size_t(k2) * n2;     // for the products
+    auto product = [&](const double *p, int ldp, const double *q, int ldq, double *out, int ldo) {
+        strassen_product(m2, n2, k2, p, ldp, q, ldq, out, ldo, deeper, crossover);
+    };
+
+    block_sub(m2, k2, a11, lda, a21, lda, x, k2);    // S3 = A11 - A21
+    block_sub(k2, n2, b22, ldb, b12, ldb, y, n2);    // T3 = B22 - B12
+    product(x, k2, y, n2, c21, ldc);                 // P7 = S3 T3
+    block_add(m2, k2, a21, lda, a22, lda, x, k2);    // S1 = A21 + A22
+    block_sub(k2, n2, b12, ldb, b11, ldb, y, n2);    // T1 = B12 - B11
+    product(x, k2, y, n2, c22, ldc);                 // P5 = S1 T1
+    block_sub(m2, k2, x, k2, a11, lda, x, k2);       // S2 = S1 - A11
+    block_sub(k2, n2, b22, ldb, y, n2, y, n2);       // T2 = B22 - T1
+    product(x, k2, y, n2, c12, ldc);                 // P6 = S2 T2
+    block_sub(m2, k2, a12, lda, x, k2, x, k2);       // S4 = A12 - S2
+    block_sub(k2, n2, y, n2, b21, ldb, y, n2);       // T4 = T2 - B21
+    product(x, k2, b22, ldb, c11, ldc);              // P3 = S4 B22
+    product(a11, lda, b11, ldb, x, n2);              // P1 = A11 B11
+    block_add(m2, n2, x, n2, c12, ldc, c12, ldc);    // U2 = P1 + P6
+    block_add(m2, n2, c12, ldc, c21, ldc, c21, ldc); // U3 = U2 + P7
+    block_add(m2, n2, c12, ldc, c22, ldc, c12, ldc); // U4 = U2 + P5
+    block_add(m2, n2, c21, ldc, c22, ldc, c22, ldc); // U7 = U3 + P5, the result's C22
+    block_add(m2, n2, c12, ldc, c11, ldc, c12, ldc); // U5 = U4 + P3, the result's C12
+    product(a22, lda, y, n2, c11, ldc);              // P4 = A22 T4
+    block_sub(m2, n2, c21, ldc, c11, ldc, c21, ldc); // U6 = U3 - P4, the result's C21
+    product(a12, lda, b21, ldb, c11, ldc);           // P2 = A12 B21
+    block_add(m2, n2, c11, ldc, x, n2, c11, ldc);    // U1 = P1 + P2, the result's C11
+
+    int me = 2 * m2, ne = 2 * n2, ke = 2 * k2; // the even part just computed
+    if (k > ke)
+        gemm_parallel(me, ne, 1, a + ke, lda, b + size_t(ke) * ldb, ldb, c, ldc);
+    if (n > ne)
+        gemm_overwrite(m, 1, k, a, lda, b + ne, ldb, c + ne, ldc);
+    if (m > me)
+        gemm_overwrite(1, ne, k, a + size_t(me) * lda, lda, b, ldb, c + size_t(me) * ldc, ldc);
+}
+
+// c = a b (overwritten) by Strassen-Winograd, with one scratch buffer for all levels.
+void gemm_strassen(int m, int n, int k, const double *a, int lda, const double *b, int ldb, double *c, int ldc,
+                   int crossover)
+{
+    size_t doubles = strassen_scratch(m, n, k, crossover);
+    double *scratch = doubles ? (double *)aligned_or_exit(doubles * sizeof(double)) : nullptr;
+    strassen_product(m, n, k, a, lda, b, ldb, c, ldc, scratch, crossover);
+    free(scratch);
+}
+
+// Time the blocked product against one level of Strassen-Winograd for square matrices of
+// growing size, and make the crossover the first size at which Strassen-Winograd is
+// faster (STRASSEN_NEVER if it never is, up to max_n). Returns the new crossover. The
+// trial products are given their crossover directly; the global one is set once, at the end.
+int calibrate_strassen_crossover(int max_n = 2048)
+{
+    int found = STRASSEN_NEVER;
+    for (int n = 256; n <= max_n && found == STRASSEN_NEVER; n = n % 3 ? n / 2 * 3 : n / 3 * 4)
+    {
+        size_t elements = size_t(n) * n;
+        double *a = (double *)aligned_or_exit(3 * elements * sizeof(double)), *b = a + elements, *c = b + elements;
+        for (size_t i = 0; i < 2 * elements; i++)
+            a[i] = double(i % 1000) / 1000 - 0.5;
+        double classic = 1e30, strassen = 1e30;
+        for (int rep = 0; rep < 3; rep++)
+        {
+            auto start = chrono::steady_clock::now();
+            gemm_overwrite(n, n, n, a, n, b, n, c, n);
+            classic = min(classic, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+            start = chrono::steady_clock::now();
+            gemm_strassen(n, n, n, a, n, b, n, c, n, n); // split this size once, not the halves
+            strassen = min(strassen, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        free(a);
+        if (strassen < 0.98 * classic) // a clear win, not noise
+            found = n;
+    }
+    set_strassen_crossover(found);
+    return found;
+}
+
+Matrix Matrix::operator*(const Matrix &other) const
+{
+    Matrix r(nrows, other.ncols); // starts at zero; gemm_parallel adds into it
+    if (nrows && other.ncols && ncols)
+    {
+        if (gemm_mode == GEMM_STRASSEN)
+            gemm_strassen(nrows, other.ncols, ncols, data, ncols, other.data, other.ncols, r.data, r.ncols,
+                          strassen_crossover);
+        else
+            gemm_parallel(nrows, other.ncols, ncols, data, ncols, other.data, other.ncols, r.data, r.ncols);
+    }
+    return r;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// The triple loop of Test/4.cpp, for a run-time size.
+Matrix multiply_naive(const Matrix &a, const Matrix &b)
+{
+    Matrix r(a.rows(), b.cols());
+    for (int i = 0; i < a.rows(); i++)
+        for (int j = 0; j < b.cols(); j++)
+        {
+            double sum = 0;
+            for (int k = 0; k < a.cols(); k++)
+                sum += a[i][k] * b[k][j];
+            r[i][j] = sum;
+        }
+    return r;
+}
+
+#ifdef MATRIX_X86
+// Peak FMA throughput: many independent chains of FMAs on registers, no memory access.
+__attribute__((target("avx512f"))) double peak_avx512(long reps)
+{
+    __m512d acc[12], x = _mm512_set1_pd(1.0000001), y = _mm512_set1_pd(0.9999999);
+    for (int i = 0; i < 12; i++)
+        acc[i] = _mm512_set1_pd(i);
+    for (long r = 0; r < reps; r++)
+        for (int i = 0; i < 12; i++)
+            acc[i] = _mm512_fmadd_pd(acc[i], x, y);
+    double s = 0;
+    double lanes[8];
+    for (int i = 0; i < 12; i++)
+    {
+        _mm512_storeu_pd(lanes, acc[i]);
+        for (double v : lanes)
+            s += v;
+    }
+    return s;
+}
+
+__attribute__((target("avx2,fma"))) double peak_avx2(long reps)
+{
+    __m256d acc[12], x = _mm256_set1_pd(1.0000001), y = _mm256_set1_pd(0.9999999);
+    for (int i = 0; i < 12; i++)
+        acc[i] = _mm256_set1_pd(i);
+    for (long r = 0; r < reps; r++)
+        for (int i = 0; i < 12; i++)
+            acc[i] = _mm256_fmadd_pd(acc[i], x, y);
+    double s = 0;
+    double lanes[4];
+    for (int i = 0; i < 12; i++)
+    {
+        _mm256_storeu_pd(lanes, acc[i]);
+        s += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return s;
+}
+#endif
+
+// GFLOP/s of the widest FMA the active kernel uses (0 if there is none).
+double measure_peak_gflops()
+{
+#ifdef MATRIX_X86
+    const long reps = 20000000;
+    int width = active_kernel().nr == 16 ? 8 : __builtin_cpu_supports("fma") ? 4 : 0;
+    if (width == 0)
+        return 0;
+    auto start = chrono::steady_clock::now();
+    volatile double sink = width == 8 ? peak_avx512(reps) : peak_avx2(reps);
+    (void)sink;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return 2.0 * width * 12 * reps / seconds / 1e9;
+#else
+    return 0;
+#endif
+}
+
+Matrix random_matrix(int rows, int cols, unsigned seed)
+{
+    Matrix m(rows, cols);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            m[i][j] = (seed >> 8) / double(1 << 24) - 0.5;
+        }
+    return m;
+}
+
+// Like random_matrix(), but with all 53 bits of every element used, so that products
+// are rounded as they would be on real data.
+Matrix random_full_matrix(int rows, int cols, unsigned long long seed)
+{
+    Matrix m(rows, cols);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            m[i][j] = (seed >> 11) / double(1ull << 53) - 0.5;
+        }
+    return m;
+}
+
+double max_difference(const Matrix &x, const Matrix &y)
+{
+    double d = 0;
+    for (int i = 0; i < x.rows(); i++)
+        for (int j = 0; j < x.cols(); j++)
+            d = max(d, fabs(x[i][j] - y[i][j]));
+    return d;
+}
+
+// The largest error of c = a b over some sampled elements, each compared with a long
+// double dot product and divided by the sum of |a[i][k] * b[k][j]|, the scale of the
+// rounding errors in that element.
+double sampled_error(const Matrix &c, const Matrix &a, const Matrix &b, int samples)
+{
+    double worst = 0;
+    unsigned seed = 12345;
+    for (int s = 0; s < samples; s++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        int i = int((seed >> 8) % unsigned(c.rows()));
+        seed = seed * 1664525u + 1013904223u;
+        int j = int((seed >> 8) % unsigned(c.cols()));
+        long double exact = 0, scale = 0;
+        for (int k = 0; k < a.cols(); k++)
+        {
+            exact += (long double)a[i][k] * b[k][j];
+            scale += fabsl((long double)a[i][k] * b[k][j]);
+        }
+        if (scale > 0)
+            worst = max(worst, double(fabsl(c[i][j] - exact) / scale));
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[])
+{
+    Matrix m1(2, 2), m2(2, 2);
+    m1[0][0] = 1; m1[0][1] = 2; m1[1][0] = 3; m1[1][1] = 4;
+    m2[0][0] = 2; m2[0][1] = 0; m2[1][0] = 1; m2[1][1] = 2;
+    cout << "Product of matrices:\n";
+    (m1 * m2).print();
+
+    int max_naive = argc > 1 ? atoi(argv[1]) : 1024;
+    int max_scaling = argc > 2 ? atoi(argv[2]) : 4096;
+    int cores = max(1, int(thread::hardware_concurrency()));
+    set_gemm_threads(1);
+    double peak = measure_peak_gflops();
+    cout << "\nMicrokernel: " << active_kernel().name << ", measured FMA peak " << peak << " GFLOP/s per core\n";
+    cout << "Single thread:\n";
+    printf("%6s %14s %10s %14s %12s\n", "n", "blocked GF/s", "% of peak", "naive GF/s", "max error");
+
+    // Odd sizes check the edge handling; powers of two are the usual benchmark sizes.
+    const int sizes[] = {100, 257, 512, 1000, 1024, 2048};
+    for (int n : sizes)
+    {
+        Matrix a = random_matrix(n, n, n), b = random_matrix(n, n, n + 1);
+        double flops = 2.0 * n * n * n;
+
+        Matrix c = a * b; // warm up: page in the buffers
+        int reps = n <= 512 ? 5 : n <= 1024 ? 3 : 1;
+        double best = 1e30;
+        for (int r = 0; r < reps; r++)
+        {
+            auto start = chrono::steady_clock::now();
+            c = a * b;
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        double blocked = flops / best / 1e9;
+
+        char naive_text[32] = "skipped", error_text[32] = "-";
+        if (n <= max_naive)
+        {
+            auto start = chrono::steady_clock::now();
+            Matrix slow = multiply_naive(a, b);
+            double naive = flops / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e9;
+            snprintf(naive_text, sizeof(naive_text), "%.2f", naive);
+            snprintf(error_text, sizeof(error_text), "%.1e", max_difference(c, slow));
+        }
+        printf("%6d %14.2f %9.1f%% %14s %12s\n", n, blocked, peak > 0 ? 100 * blocked / peak : 0.0, naive_text,
+               error_text);
+    }
+
+    // Strong scaling: the same product with 1, 2, 4, ... threads. Efficiency is the
+    // speedup over one thread divided by the number of threads.
+    cout << "\nStrong scaling (" << cores << " cores):\n";
+    printf("%6s %8s %10s %12s %10s %12s\n", "n", "threads", "seconds", "GFLOP/s", "speedup", "efficiency");
+    for (int n = 1024; n <= max_scaling; n *= 2)
+    {
+        Matrix a = random_matrix(n, n, n), b = random_matrix(n, n, n + 1);
+        double single = 0;
+        Matrix reference;
+        for (int threads = 1;; threads = min(threads * 2, cores))
+        {
+            set_gemm_threads(threads);
+            Matrix c = a * b; // the first product with a new pool size also starts its threads
+            auto start = chrono::steady_clock::now();
+            c = a * b;
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (threads == 1)
+            {
+                single = seconds;
+                reference = c;
+            }
+            printf("%6d %8d %10.3f %12.2f %9.2fx %11.0f%%%s\n", n, threads, seconds, 2.0 * n * n * n / seconds / 1e9,
+                   single / seconds, 100 * single / seconds / threads,
+                   c == reference ? "" : "  (RESULT DIFFERS FROM ONE THREAD)");
+            if (threads == cores)
+                break;
+        }
+    }
+
+    // Strassen-Winograd against the blocked product, with all threads. 2049 has odd
+    // dimensions at the first level.
+    set_gemm_threads(cores);
+    cout << "\nStrassen-Winograd (" << cores << " threads): ";
+    int crossover = calibrate_strassen_crossover();
+    if (crossover == STRASSEN_NEVER)
+    {
+        cout << "never faster here up to n = 2048; using crossover 512 to show the accuracy\n";
+        set_strassen_crossover(512);
+    }
+    else
+        cout << "calibrated crossover n = " << crossover << "\n";
+    printf("%6s %12s %12s %10s %8s %15s %15s\n", "n", "classic s", "Strassen s", "speedup", "levels", "classic error",
+           "Strassen error");
+    for (int n : {1024, 2048, 2049, 4096})
+    {
+        if (n > max_scaling)
+            continue;
+        Matrix a = random_full_matrix(n, n, n), b = random_full_matrix(n, n, n + 1);
+        int levels = 0;
+        for (int s = n; s >= strassen_crossover; s /= 2)
+            levels++;
+        double seconds[2];
+        Matrix c[2];
+        for (int mode = 0; mode < 2; mode++)
+        {
+            set_gemm_algorithm(mode ? GEMM_STRASSEN : GEMM_CLASSIC);
+            auto start = chrono::steady_clock::now();
+            c[mode] = a * b;
+            seconds[mode] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        set_gemm_algorithm(GEMM_CLASSIC);
+        printf("%6d %12.3f %12.3f %9.2fx %8d %15.1e %15.1e\n", n, seconds[0], seconds[1], seconds[0] / seconds[1],
+               levels, sampled_error(c[0], a, b, 200), sampled_error(c[1], a, b, 200));
+    }
+    cout << "errors: largest over 200 sampled elements, relative to the sum of |a[i][k] b[k][j]|\n";
+    return 0;
+}
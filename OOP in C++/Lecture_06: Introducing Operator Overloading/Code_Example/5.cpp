@@ -0,0 +1,483 @@
+/*
+5. With the operators of 2.cpp (and of the run-time sized Matrix of 4.cpp) an expression
+such as
+        r = m1 + m2 - m3 * 2
+is evaluated one operator at a time: m1 + m2 is written to a temporary matrix, m3 * 2 to
+a second one, their difference to a third, and that is copied into r. Every element is
+read and written to memory several times, although each element of r only depends on
+the same element of m1, m2 and m3. For matrices larger than the caches the time goes
+almost entirely into moving those temporaries.
+
+This program uses expression templates instead. +, - and multiplication or division by
+a scalar do not compute anything: they return a small object that remembers the
+operation and its operands (references to the matrices, or other such objects). The
+type of r = m1 + m2 - m3 * 2 on the right is
+
+    binary_expr<binary_expr<Matrix, Matrix, add_op>, scalar_expr<Matrix, mul_op>, sub_op>
+
+and the work is done only when it is assigned to a Matrix: one loop over the elements,
+computing each element of the whole expression at once, with no temporary matrix. The
+loop takes SIMD_BYTES at a time (GCC vector extensions, as in 3.cpp), so every node of
+the expression also has a packet() function that computes several elements at once.
+Unary minus and abs() are lazy in the same way.
+
+The product of two matrices is not element-wise, so it stays eager: it returns a Matrix,
+computed with a cache-blocked loop (see 4.cpp for the much faster packed version). If
+an operand of a product is an expression, it is evaluated first.
+
+As with every expression-template library, an expression holds references to its
+matrices, so it must be assigned to a Matrix in the same statement: "auto e = m1 + m2;"
+keeps references that may dangle.
+
+main() repeats the example of 2.cpp, then evaluates
+        r = a + b - c * 2.0 + d
+on matrices of n elements, fused and one operator at a time, and reports the time and
+the memory traffic of each. The default n is 20 million elements (160 MB per matrix);
+100 million elements need about 6 GB of memory for the unfused version.
+
+Compile and run with (add -march=native to let the compiler use AVX):
+    g++ -std=c++17 -O2 5.cpp -o expression_templates
+    ./expression_templates [elements]
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+// The widest SIMD value the compiler may use: 32 bytes with AVX, otherwise 16 (SSE).
+#ifdef __AVX__
+const size_t SIMD_BYTES = 32;
+#else
+const size_t SIMD_BYTES = 16;
+#endif
+
+// Several doubles processed by one instruction. may_alias lets a packet be loaded from
+// and stored to an array of double.
+typedef double packet_type __attribute__((vector_size(SIMD_BYTES), __may_alias__));
+const size_t LANES = SIMD_BYTES / sizeof(double);
+
+void *aligned_or_exit(size_t bytes)
+{
+    // aligned_alloc() needs a size that is a multiple of the alignment.
+    void *p = aligned_alloc(64, (bytes + 63) / 64 * 64 + 64);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    return p;
+}
+
+void check_sizes(int rows1, int cols1, int rows2, int cols2)
+{
+    if (rows1 != rows2 || cols1 != cols2)
+    {
+        cout << " Matrix size mismatch \n";
+        exit(1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Expression nodes
+// ---------------------------------------------------------------------------
+
+// Base of every expression: E is the actual node type (the "curiously recurring
+// template pattern"), so an operator can accept any expression and still know its type.
+// Every E has rows(), cols(), at(i) (element i in row-major order) and packet(i)
+// (elements i .. i+LANES-1, with i a multiple of LANES).
+template <class E>
+struct matrix_expr
+{
+    const E &self() const { return static_cast<const E &>(*this); }
+};
+
+class Matrix;
+
+// How a node keeps an operand: matrices by reference, other nodes (which are small and
+// usually temporaries) by value.
+template <class E>
+struct operand
+{
+    typedef const E type;
+};
+template <>
+struct operand<Matrix>
+{
+    typedef const Matrix &type;
+};
+
+// The operations, each written once for double and for packet_type.
+struct add_op
+{
+    template <class V>
+    static V apply(V x, V y) { return x + y; }
+};
+struct sub_op
+{
+    template <class V>
+    static V apply(V x, V y) { return x - y; }
+};
+struct mul_op
+{
+    template <class V>
+    static V apply(V x, double s) { return x * s; }
+};
+struct div_op
+{
+    template <class V>
+    static V apply(V x, double s) { return x / s; }
+};
+struct neg_op
+{
+    template <class V>
+    static V apply(V x) { return -x; }
+};
+struct abs_op
+{
+    template <class V>
+    static V apply(V x) { return x < V{} ? -x : x; }
+};
+
+// Declare an element-wise operation on two expressions of the same size.
+template <class L, class R, class Op>
+class binary_expr : public matrix_expr<binary_expr<L, R, Op>>
+{
+    typename operand<L>::type left;
+    typename operand<R>::type right;
+
+public:
+    binary_expr(const L &l, const R &r) : left(l), right(r)
+    {
+        check_sizes(l.rows(), l.cols(), r.rows(), r.cols());
+    }
+    int rows() const { return left.rows(); }
+    int cols() const { return left.cols(); }
+    double at(size_t i) const { return Op::apply(left.at(i), right.at(i)); }
+    packet_type packet(size_t i) const { return Op::apply(left.packet(i), right.packet(i)); }
+};
+
+// Declare an expression combined with a scalar (multiplied or divided by it).
+template <class E, class Op>
+class scalar_expr : public matrix_expr<scalar_expr<E, Op>>
+{
+    typename operand<E>::type inner;
+    double scalar;
+
+public:
+    scalar_expr(const E &e, double s) : inner(e), scalar(s) {}
+    int rows() const { return inner.rows(); }
+    int cols() const { return inner.cols(); }
+    double at(size_t i) const { return Op::apply(inner.at(i), scalar); }
+    packet_type packet(size_t i) const { return Op::apply(inner.packet(i), scalar); }
+};
+
+// Declare a function applied to every element of an expression.
+template <class E, class Op>
+class unary_expr : public matrix_expr<unary_expr<E, Op>>
+{
+    typename operand<E>::type inner;
+
+public:
+    explicit unary_expr(const E &e) : inner(e) {}
+    int rows() const { return inner.rows(); }
+    int cols() const { return inner.cols(); }
+    double at(size_t i) const { return Op::apply(inner.at(i)); }
+    packet_type packet(size_t i) const { return Op::apply(inner.packet(i)); }
+};
+
+template <class L, class R>
+binary_expr<L, R, add_op> operator+(const matrix_expr<L> &l, const matrix_expr<R> &r)
+{
+    return binary_expr<L, R, add_op>(l.self(), r.self());
+}
+
+template <class L, class R>
+binary_expr<L, R, sub_op> operator-(const matrix_expr<L> &l, const matrix_expr<R> &r)
+{
+    return binary_expr<L, R, sub_op>(l.self(), r.self());
+}
+
+template <class E>
+scalar_expr<E, mul_op> operator*(const matrix_expr<E> &e, double s)
+{
+    return scalar_expr<E, mul_op>(e.self(), s);
+}
+
+template <class E>
+scalar_expr<E, mul_op> operator*(double s, const matrix_expr<E> &e)
+{
+    return scalar_expr<E, mul_op>(e.self(), s);
+}
+
+template <class E>
+scalar_expr<E, div_op> operator/(const matrix_expr<E> &e, double s)
+{
+    return scalar_expr<E, div_op>(e.self(), s);
+}
+
+template <class E>
+unary_expr<E, neg_op> operator-(const matrix_expr<E> &e)
+{
+    return unary_expr<E, neg_op>(e.self());
+}
+
+template <class E>
+unary_expr<E, abs_op> abs(const matrix_expr<E> &e)
+{
+    return unary_expr<E, abs_op>(e.self());
+}
+
+// ---------------------------------------------------------------------------
+// Matrix
+// ---------------------------------------------------------------------------
+
+// Declare a dense matrix of doubles whose size is chosen at run time.
+class Matrix : public matrix_expr<Matrix>
+{
+    int nrows, ncols;
+    double *data; // row-major, 64-byte aligned
+
+    // The one loop that evaluates an expression, a packet at a time.
+    template <class E>
+    void assign(const E &e);
+
+public:
+    Matrix(int rows = 0, int cols = 0);
+    Matrix(const Matrix &other);
+    Matrix(Matrix &&other) noexcept;
+    template <class E>
+    Matrix(const matrix_expr<E> &e);
+    ~Matrix() { free(data); }
+    Matrix &operator=(const Matrix &other);
+    Matrix &operator=(Matrix &&other) noexcept;
+    template <class E>
+    Matrix &operator=(const matrix_expr<E> &e);
+
+    int rows() const { return nrows; }
+    int cols() const { return ncols; }
+    size_t size() const { return size_t(nrows) * ncols; }
+    double *operator[](int row) { return data + size_t(row) * ncols; } // access row as array
+    const double *operator[](int row) const { return data + size_t(row) * ncols; }
+
+    // The leaf of every expression.
+    double at(size_t i) const { return data[i]; }
+    packet_type packet(size_t i) const { return *(const packet_type *)(data + i); }
+
+    bool operator==(const Matrix &other) const;
+    Matrix &operator++();
+    void print() const;
+};
+
+Matrix::Matrix(int rows, int cols) : nrows(rows), ncols(cols)
+{
+    data = (double *)aligned_or_exit(size() * sizeof(double));
+    memset(data, 0, size() * sizeof(double));
+}
+
+Matrix::Matrix(const Matrix &other) : nrows(other.nrows), ncols(other.ncols)
+{
+    data = (double *)aligned_or_exit(size() * sizeof(double));
+    memcpy(data, other.data, size() * sizeof(double));
+}
+
+Matrix::Matrix(Matrix &&other) noexcept : nrows(other.nrows), ncols(other.ncols), data(other.data)
+{
+    other.nrows = other.ncols = 0;
+    other.data = nullptr;
+}
+
+template <class E>
+Matrix::Matrix(const matrix_expr<E> &e) : nrows(e.self().rows()), ncols(e.self().cols())
+{
+    data = (double *)aligned_or_exit(size() * sizeof(double)); // no need to zero it first
+    assign(e.self());
+}
+
+Matrix &Matrix::operator=(const Matrix &other)
+{
+    if (this != &other)
+    {
+        Matrix copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Matrix &Matrix::operator=(Matrix &&other) noexcept
+{
+    if (this != &other)
+    {
+        free(data);
+        nrows = other.nrows;
+        ncols = other.ncols;
+        data = other.data;
+        other.nrows = other.ncols = 0;
+        other.data = nullptr;
+    }
+    return *this;
+}
+
+// Element i of the result depends only on element i of each operand, so the matrix
+// being assigned may appear in the expression (m1 = m1 + m2).
+template <class E>
+Matrix &Matrix::operator=(const matrix_expr<E> &e)
+{
+    const E &x = e.self();
+    if (x.rows() != nrows || x.cols() != ncols)
+    {
+        Matrix r(x); // new size: evaluate into new storage
+        *this = std::move(r);
+    }
+    else
+        assign(x);
+    return *this;
+}
+
+template <class E>
+void Matrix::assign(const E &e)
+{
+    size_t n = size(), i = 0;
+    for (; i + LANES <= n; i += LANES)
+        *(packet_type *)(data + i) = e.packet(i);
+    for (; i < n; i++)
+        data[i] = e.at(i);
+}
+
+bool Matrix::operator==(const Matrix &other) const
+{
+    return nrows == other.nrows && ncols == other.ncols && memcmp(data, other.data, size() * sizeof(double)) == 0;
+}
+
+Matrix &Matrix::operator++()
+{
+    for (size_t i = 0; i < size(); i++)
+        ++data[i];
+    return *this;
+}
+
+void Matrix::print() const
+{
+    for (int i = 0; i < nrows; i++)
+    {
+        for (int j = 0; j < ncols; j++)
+            cout << (*this)[i][j] << " ";
+        cout << endl;
+    }
+}
+
+// The product is computed at once. Blocks of BLOCK x BLOCK keep the rows of b that are
+// in use in the cache, and the inner loop runs along rows of b and c.
+Matrix multiply(const Matrix &a, const Matrix &b)
+{
+    const int BLOCK = 64;
+    check_sizes(a.cols(), 0, b.rows(), 0);
+    Matrix c(a.rows(), b.cols());
+    for (int k0 = 0; k0 < a.cols(); k0 += BLOCK)
+        for (int j0 = 0; j0 < b.cols(); j0 += BLOCK)
+        {
+            int k1 = min(k0 + BLOCK, a.cols()), j1 = min(j0 + BLOCK, b.cols());
+            for (int i = 0; i < a.rows(); i++)
+            {
+                double *ci = c[i];
+                for (int k = k0; k < k1; k++)
+                {
+                    double aik = a[i][k];
+                    const double *bk = b[k];
+                    for (int j = j0; j < j1; j++)
+                        ci[j] += aik * bk[j];
+                }
+            }
+        }
+    return c;
+}
+
+// Operands that are expressions are evaluated into matrices first.
+template <class L, class R>
+Matrix operator*(const matrix_expr<L> &l, const matrix_expr<R> &r)
+{
+    return multiply(Matrix(l), Matrix(r));
+}
+
+inline Matrix operator*(const matrix_expr<Matrix> &l, const matrix_expr<Matrix> &r)
+{
+    return multiply(l.self(), r.self());
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    // The example of 2.cpp, with 2x2 matrices of the run-time sized type.
+    Matrix m1(2, 2), m2(2, 2);
+    m1[0][0] = 1, m1[0][1] = 2, m1[1][0] = 3, m1[1][1] = 4;
+    m2[0][0] = 5, m2[0][1] = 6, m2[1][0] = 7, m2[1][1] = 8;
+
+    Matrix m3 = m1 + m2;
+    cout << "m1 + m2:" << endl; m3.print();
+    Matrix m4 = m2 - m1;
+    cout << "m2 - m1:" << endl; m4.print();
+    Matrix m5 = m1 * m2;
+    cout << "m1 * m2:" << endl; m5.print();
+    Matrix m6 = m1 + m2 - m3 * 2;
+    cout << "m1 + m2 - m3 * 2 (one loop):" << endl; m6.print();
+    Matrix m7 = abs(-(m1 - m2)) / 2 + (m1 + m2) * m1;
+    cout << "abs(-(m1 - m2)) / 2 + (m1 + m2) * m1:" << endl; m7.print();
+    ++m1;
+    cout << "++m1:" << endl; m1.print();
+    cout << "m1 == m2? " << (m1 == m2) << endl;
+
+    // r = a + b - c * 2 + d on large matrices: 4 matrices read, 1 written.
+    long elements = argc > 1 ? atol(argv[1]) : 20000000;
+    const int cols = 1000;
+    int rows = int(max(1L, elements / cols));
+    double mb = double(rows) * cols * sizeof(double) / 1e6;
+    Matrix a(rows, cols), b(rows, cols), c(rows, cols), d(rows, cols), r(rows, cols), check(rows, cols);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+        {
+            a[i][j] = i + j;
+            b[i][j] = 0.5 * j;
+            c[i][j] = i - 2.0 * j;
+            d[i][j] = 1.0 / (j + 1);
+        }
+    cout << "\nr = a + b - c * 2.0 + d on " << rows << " x " << cols << " matrices (" << mb << " MB each):\n";
+    printf("%-26s %10s %14s %10s\n", "", "seconds", "memory moved", "GB/s");
+
+    double best_fused = 1e30, best_eager = 1e30;
+    for (int rep = 0; rep < 3; rep++)
+    {
+        auto start = chrono::steady_clock::now();
+        r = a + b - c * 2.0 + d;
+        best_fused = min(best_fused, seconds_since(start));
+
+        // What the operators of 4.cpp do: every operator writes a new matrix.
+        start = chrono::steady_clock::now();
+        {
+            Matrix t1 = a + b;
+            Matrix t2 = c * 2.0;
+            Matrix t3 = t1 - t2;
+            check = t3 + d;
+        }
+        best_eager = min(best_eager, seconds_since(start));
+    }
+    // Fused: read a, b, c, d and write r. One operator at a time: read 2 and write 1 for
+    // each of the three + and -, and read 1 and write 1 for * 2.0.
+    double fused_mb = 5 * mb, eager_mb = 11 * mb;
+    printf("%-26s %10.3f %11.0f MB %10.2f\n", "fused (expression)", best_fused, fused_mb, fused_mb / 1e3 / best_fused);
+    printf("%-26s %10.3f %11.0f MB %10.2f\n", "one operator at a time", best_eager, eager_mb,
+           eager_mb / 1e3 / best_eager);
+    cout << "Fused is " << best_eager / best_fused << " times faster and moves " << eager_mb - fused_mb
+         << " MB less; the results are " << (r == check ? "identical" : "DIFFERENT") << ".\n";
+    return 0;
+}
@@ -0,0 +1,543 @@
+/*
+6. Multiplying a million pairs of the 2x2 matrices of 2.cpp means a million calls of
+operator*, each loading eight doubles, doing 12 operations on them and returning a new
+Matrix by value. The compiler can use SIMD instructions inside one product, but a 2x2
+product has little to offer them: most of every register is wasted.
+
+When there are many matrices it is better to store them the other way round. A
+Matrix2x2Batch keeps the top-left elements of all its matrices in one array, the
+top-right elements in a second, and so on ("structure of arrays"):
+
+    array of objects:   a0 b0 c0 d0 | a1 b1 c1 d1 | a2 b2 c2 d2 | ...
+    structure of arrays: a: a0 a1 a2 ...   b: b0 b1 b2 ...   c: ...   d: ...
+
+Now one SIMD register holds the same element of several consecutive matrices, and the
+formula for one product, applied to whole registers, computes several products at once
+with no shuffling at all. With doubles an AVX2 register holds 4 matrices' elements
+and an AVX-512 register 8; the loops below take two registers per step, so 8 or 16
+matrices per iteration.
+
+Batch add, multiply, determinant and inverse are written three times: plain C++, AVX2 and
+AVX-512. The version is picked at run time from what the CPU supports, as in 4.cpp.
+inverse() returns the number of singular matrices (determinant 0); their results are
+infinities or NaNs, as the formula gives. Every version rounds the same way, so they give
+identical results: sums of two products are fused multiply-adds in all of them.
+
+main() compares, per matrix, the batch functions (each version the CPU supports) with a
+loop over an array of 2.cpp's Matrix objects, for batches that fit in the L1 cache
+(256 matrices) and for batches of a million matrices, which come from memory. From
+memory every version runs at the speed of memory, and the layout hardly matters; the
+batch kernels pay off on data that is in the cache, or when more work is done per load.
+
+Compile and run with (add -mfma or -march=native so that std::fma in the plain C++ version
+is one instruction rather than a library call):
+    g++ -std=c++17 -O2 6.cpp -o batch2x2
+    ./batch2x2 [large_batch_size]
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+using namespace std;
+
+// The Matrix of 2.cpp, used for the array-of-objects layout.
+class Matrix
+{
+private:
+    double data[2][2]; // Simple 2x2 matrix
+
+public:
+    Matrix(double a = 0, double b = 0, double c = 0, double d = 0)
+    {
+        data[0][0] = a; data[0][1] = b;
+        data[1][0] = c; data[1][1] = d;
+    }
+
+    Matrix operator+(const Matrix &other)
+    {
+        return Matrix(
+            data[0][0] + other.data[0][0], data[0][1] + other.data[0][1],
+            data[1][0] + other.data[1][0], data[1][1] + other.data[1][1]);
+    }
+
+    Matrix operator*(const Matrix &other)
+    {
+        return Matrix(
+            data[0][0] * other.data[0][0] + data[0][1] * other.data[1][0],
+            data[0][0] * other.data[0][1] + data[0][1] * other.data[1][1],
+            data[1][0] * other.data[0][0] + data[1][1] * other.data[1][0],
+            data[1][0] * other.data[0][1] + data[1][1] * other.data[1][1]);
+    }
+
+    double *operator[](int index) { return data[index]; }
+};
+
+void *aligned_or_exit(size_t bytes)
+{
+    // aligned_alloc() needs a size that is a multiple of the alignment.
+    void *p = aligned_alloc(64, (bytes + 63) / 64 * 64 + 64);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    return p;
+}
+
+// Declare a batch of 2x2 matrices stored as four arrays, one per element.
+class Matrix2x2Batch
+{
+    size_t count;
+    size_t capacity; // distance between the arrays, in elements (see the constructor)
+    double *storage; // the four arrays, one after the other, each 64-byte aligned
+
+public:
+    explicit Matrix2x2Batch(size_t n);
+    ~Matrix2x2Batch() { free(storage); }
+    Matrix2x2Batch(const Matrix2x2Batch &) = delete;
+    Matrix2x2Batch &operator=(const Matrix2x2Batch &) = delete;
+
+    size_t size() const { return count; }
+    // Element k (0 = a, 1 = b, 2 = c, 3 = d) of every matrix.
+    double *lane(int k) { return storage + k * capacity; }
+    const double *lane(int k) const { return storage + k * capacity; }
+
+    void set(size_t i, Matrix m);
+    Matrix get(size_t i) const;
+};
+
+// Each array is rounded up to whole cache lines plus one more. Without the extra line, a
+// batch of 512 matrices would put its arrays exactly 4 KB apart, and the processor would
+// mistake loads from one array for loads of what was just stored to another (addresses
+// are first compared by their low 12 bits), stalling them.
+Matrix2x2Batch::Matrix2x2Batch(size_t n) : count(n), capacity((n + 7) / 8 * 8 + 8)
+{
+    storage = (double *)aligned_or_exit(4 * capacity * sizeof(double));
+    memset(storage, 0, 4 * capacity * sizeof(double));
+}
+
+void Matrix2x2Batch::set(size_t i, Matrix m)
+{
+    lane(0)[i] = m[0][0];
+    lane(1)[i] = m[0][1];
+    lane(2)[i] = m[1][0];
+    lane(3)[i] = m[1][1];
+}
+
+Matrix Matrix2x2Batch::get(size_t i) const
+{
+    return Matrix(lane(0)[i], lane(1)[i], lane(2)[i], lane(3)[i]);
+}
+
+// ---------------------------------------------------------------------------
+// Kernels
+// ---------------------------------------------------------------------------
+
+// The kernels work on matrices [from, n) of the lanes x and y and write the lanes of out
+// (or one array, for the determinant). out may be x or y.
+typedef const double *const in_lanes[4];
+typedef double *const out_lanes[4];
+
+// Plain C++: also finishes the last few matrices for the SIMD versions.
+void add_generic(size_t from, size_t n, in_lanes x, in_lanes y, out_lanes out)
+{
+    for (int k = 0; k < 4; k++)
+        for (size_t i = from; i < n; i++)
+            out[k][i] = x[k][i] + y[k][i];
+}
+
+// The plain C++ kernels round exactly as the SIMD ones do: every sum of two products is
+// one fused multiply-add, a*e + b*g = fma(a, e, b*g). Otherwise the versions would not
+// agree near 0: a*d - b*c is exactly 0 for [[0.1, 0.1], [0.1, 0.1]] with two roundings,
+// but the rounding error of 0.1*0.1 with one, and the matrix would be singular or not
+// depending on the CPU. (std::fma is one instruction where the CPU has FMA.)
+void multiply_generic(size_t from, size_t n, in_lanes x, in_lanes y, out_lanes out)
+{
+    for (size_t i = from; i < n; i++)
+    {
+        double a = x[0][i], b = x[1][i], c = x[2][i], d = x[3][i];
+        double e = y[0][i], f = y[1][i], g = y[2][i], h = y[3][i];
+        out[0][i] = fma(a, e, b * g);
+        out[1][i] = fma(a, f, b * h);
+        out[2][i] = fma(c, e, d * g);
+        out[3][i] = fma(c, f, d * h);
+    }
+}
+
+void determinant_generic(size_t from, size_t n, in_lanes x, double *out)
+{
+    for (size_t i = from; i < n; i++)
+        out[i] = fma(x[0][i], x[3][i], -(x[1][i] * x[2][i]));
+}
+
+size_t inverse_generic(size_t from, size_t n, in_lanes x, out_lanes out)
+{
+    size_t singular = 0;
+    for (size_t i = from; i < n; i++)
+    {
+        double a = x[0][i], b = x[1][i], c = x[2][i], d = x[3][i];
+        double det = fma(a, d, -(b * c));
+        singular += det == 0;
+        double r = 1.0 / det;
+        out[0][i] = d * r;
+        out[1][i] = -b * r;
+        out[2][i] = -c * r;
+        out[3][i] = a * r;
+    }
+    return singular;
+}
+
+#ifdef BATCH_X86
+// AVX2 + FMA: two registers of 4 doubles per lane and step, so 8 matrices per step.
+__attribute__((target("avx2,fma"))) size_t add_avx2(size_t n, in_lanes x, in_lanes y, out_lanes out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (int k = 0; k < 4; k++)
+        {
+            __m256d s0 = _mm256_add_pd(_mm256_loadu_pd(x[k] + i), _mm256_loadu_pd(y[k] + i));
+            __m256d s1 = _mm256_add_pd(_mm256_loadu_pd(x[k] + i + 4), _mm256_loadu_pd(y[k] + i + 4));
+            _mm256_storeu_pd(out[k] + i, s0);
+            _mm256_storeu_pd(out[k] + i + 4, s1);
+        }
+    return i;
+}
+
+__attribute__((target("avx2,fma"))) size_t multiply_avx2(size_t n, in_lanes x, in_lanes y, out_lanes out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (size_t h = i; h < i + 8; h += 4)
+        {
+            __m256d a = _mm256_loadu_pd(x[0] + h), b = _mm256_loadu_pd(x[1] + h);
+            __m256d c = _mm256_loadu_pd(x[2] + h), d = _mm256_loadu_pd(x[3] + h);
+            __m256d e = _mm256_loadu_pd(y[0] + h), f = _mm256_loadu_pd(y[1] + h);
+            __m256d g = _mm256_loadu_pd(y[2] + h), hh = _mm256_loadu_pd(y[3] + h);
+            _mm256_storeu_pd(out[0] + h, _mm256_fmadd_pd(a, e, _mm256_mul_pd(b, g)));
+            _mm256_storeu_pd(out[1] + h, _mm256_fmadd_pd(a, f, _mm256_mul_pd(b, hh)));
+            _mm256_storeu_pd(out[2] + h, _mm256_fmadd_pd(c, e, _mm256_mul_pd(d, g)));
+            _mm256_storeu_pd(out[3] + h, _mm256_fmadd_pd(c, f, _mm256_mul_pd(d, hh)));
+        }
+    return i;
+}
+
+__attribute__((target("avx2,fma"))) size_t determinant_avx2(size_t n, in_lanes x, double *out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (size_t h = i; h < i + 8; h += 4)
+        {
+            __m256d bc = _mm256_mul_pd(_mm256_loadu_pd(x[1] + h), _mm256_loadu_pd(x[2] + h));
+            _mm256_storeu_pd(out + h, _mm256_fmsub_pd(_mm256_loadu_pd(x[0] + h), _mm256_loadu_pd(x[3] + h), bc));
+        }
+    return i;
+}
+
+__attribute__((target("avx2,fma"))) size_t inverse_avx2(size_t n, in_lanes x, out_lanes out, size_t &singular)
+{
+    const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+    const __m256d sign = _mm256_set1_pd(-0.0); // -x flips the sign, as in C++ (0 - x would make -0 into +0)
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (size_t h = i; h < i + 8; h += 4)
+        {
+            __m256d a = _mm256_loadu_pd(x[0] + h), b = _mm256_loadu_pd(x[1] + h);
+            __m256d c = _mm256_loadu_pd(x[2] + h), d = _mm256_loadu_pd(x[3] + h);
+            __m256d det = _mm256_fmsub_pd(a, d, _mm256_mul_pd(b, c));
+            singular += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(det, zero, _CMP_EQ_OQ)));
+            __m256d r = _mm256_div_pd(one, det);
+            _mm256_storeu_pd(out[0] + h, _mm256_mul_pd(d, r));
+            _mm256_storeu_pd(out[1] + h, _mm256_mul_pd(_mm256_xor_pd(b, sign), r));
+            _mm256_storeu_pd(out[2] + h, _mm256_mul_pd(_mm256_xor_pd(c, sign), r));
+            _mm256_storeu_pd(out[3] + h, _mm256_mul_pd(a, r));
+        }
+    return i;
+}
+
+// AVX-512: two registers of 8 doubles per lane and step, so 16 matrices per step.
+__attribute__((target("avx512f"))) size_t add_avx512(size_t n, in_lanes x, in_lanes y, out_lanes out)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        for (int k = 0; k < 4; k++)
+        {
+            __m512d s0 = _mm512_add_pd(_mm512_loadu_pd(x[k] + i), _mm512_loadu_pd(y[k] + i));
+            __m512d s1 = _mm512_add_pd(_mm512_loadu_pd(x[k] + i + 8), _mm512_loadu_pd(y[k] + i + 8));
+            _mm512_storeu_pd(out[k] + i, s0);
+            _mm512_storeu_pd(out[k] + i + 8, s1);
+        }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t multiply_avx512(size_t n, in_lanes x, in_lanes y, out_lanes out)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        for (size_t h = i; h < i + 16; h += 8)
+        {
+            __m512d a = _mm512_loadu_pd(x[0] + h), b = _mm512_loadu_pd(x[1] + h);
+            __m512d c = _mm512_loadu_pd(x[2] + h), d = _mm512_loadu_pd(x[3] + h);
+            __m512d e = _mm512_loadu_pd(y[0] + h), f = _mm512_loadu_pd(y[1] + h);
+            __m512d g = _mm512_loadu_pd(y[2] + h), hh = _mm512_loadu_pd(y[3] + h);
+            _mm512_storeu_pd(out[0] + h, _mm512_fmadd_pd(a, e, _mm512_mul_pd(b, g)));
+            _mm512_storeu_pd(out[1] + h, _mm512_fmadd_pd(a, f, _mm512_mul_pd(b, hh)));
+            _mm512_storeu_pd(out[2] + h, _mm512_fmadd_pd(c, e, _mm512_mul_pd(d, g)));
+            _mm512_storeu_pd(out[3] + h, _mm512_fmadd_pd(c, f, _mm512_mul_pd(d, hh)));
+        }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t determinant_avx512(size_t n, in_lanes x, double *out)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        for (size_t h = i; h < i + 16; h += 8)
+        {
+            __m512d bc = _mm512_mul_pd(_mm512_loadu_pd(x[1] + h), _mm512_loadu_pd(x[2] + h));
+            _mm512_storeu_pd(out + h, _mm512_fmsub_pd(_mm512_loadu_pd(x[0] + h), _mm512_loadu_pd(x[3] + h), bc));
+        }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t inverse_avx512(size_t n, in_lanes x, out_lanes out, size_t &singular)
+{
+    const __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1.0);
+    const __m512i sign = _mm512_castpd_si512(_mm512_set1_pd(-0.0)); // -x flips the sign, as in C++
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        for (size_t h = i; h < i + 16; h += 8)
+        {
+            __m512d a = _mm512_loadu_pd(x[0] + h), b = _mm512_loadu_pd(x[1] + h);
+            __m512d c = _mm512_loadu_pd(x[2] + h), d = _mm512_loadu_pd(x[3] + h);
+            __m512d det = _mm512_fmsub_pd(a, d, _mm512_mul_pd(b, c));
+            singular += __builtin_popcount(_mm512_cmp_pd_mask(det, zero, _CMP_EQ_OQ));
+            __m512d r = _mm512_div_pd(one, det);
+            _mm512_storeu_pd(out[0] + h, _mm512_mul_pd(d, r));
+            __m512d minus_b = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(b), sign));
+            __m512d minus_c = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(c), sign));
+            _mm512_storeu_pd(out[1] + h, _mm512_mul_pd(minus_b, r));
+            _mm512_storeu_pd(out[2] + h, _mm512_mul_pd(minus_c, r));
+            _mm512_storeu_pd(out[3] + h, _mm512_mul_pd(a, r));
+        }
+    return i;
+}
+#endif
+
+// One set of kernels. Each SIMD kernel handles whole steps and returns how many matrices
+// it did; the plain C++ kernels finish the rest.
+struct batch_kernels
+{
+    size_t (*add)(size_t n, in_lanes x, in_lanes y, out_lanes out);
+    size_t (*multiply)(size_t n, in_lanes x, in_lanes y, out_lanes out);
+    size_t (*determinant)(size_t n, in_lanes x, double *out);
+    size_t (*inverse)(size_t n, in_lanes x, out_lanes out, size_t &singular);
+    const char *name;
+};
+
+size_t none_binary(size_t, in_lanes, in_lanes, out_lanes) { return 0; }
+size_t none_determinant(size_t, in_lanes, double *) { return 0; }
+size_t none_inverse(size_t, in_lanes, out_lanes, size_t &) { return 0; }
+
+const batch_kernels generic_kernels = {none_binary, none_binary, none_determinant, none_inverse, "generic"};
+#ifdef BATCH_X86
+const batch_kernels avx2_kernels = {add_avx2, multiply_avx2, determinant_avx2, inverse_avx2, "AVX2+FMA"};
+const batch_kernels avx512_kernels = {add_avx512, multiply_avx512, determinant_avx512, inverse_avx512, "AVX-512"};
+#endif
+
+// Every set this CPU can run, best first.
+vector<const batch_kernels *> supported_kernels()
+{
+    vector<const batch_kernels *> sets;
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        sets.push_back(&avx512_kernels);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        sets.push_back(&avx2_kernels);
+#endif
+    sets.push_back(&generic_kernels);
+    return sets;
+}
+
+// The set used by the batch functions, chosen once. Can be changed to compare them.
+const batch_kernels *active_kernels = supported_kernels().front();
+
+// ---------------------------------------------------------------------------
+// Batch operations
+// ---------------------------------------------------------------------------
+
+void check_sizes(size_t n1, size_t n2)
+{
+    if (n1 != n2)
+    {
+        cout << " Batch size mismatch \n";
+        exit(1);
+    }
+}
+
+// out[i] = x[i] + y[i] for every i.
+void add(const Matrix2x2Batch &x, const Matrix2x2Batch &y, Matrix2x2Batch &out)
+{
+    check_sizes(x.size(), y.size());
+    check_sizes(x.size(), out.size());
+    in_lanes xl = {x.lane(0), x.lane(1), x.lane(2), x.lane(3)}, yl = {y.lane(0), y.lane(1), y.lane(2), y.lane(3)};
+    out_lanes ol = {out.lane(0), out.lane(1), out.lane(2), out.lane(3)};
+    add_generic(active_kernels->add(x.size(), xl, yl, ol), x.size(), xl, yl, ol);
+}
+
+// out[i] = x[i] * y[i] for every i.
+void multiply(const Matrix2x2Batch &x, const Matrix2x2Batch &y, Matrix2x2Batch &out)
+{
+    check_sizes(x.size(), y.size());
+    check_sizes(x.size(), out.size());
+    in_lanes xl = {x.lane(0), x.lane(1), x.lane(2), x.lane(3)}, yl = {y.lane(0), y.lane(1), y.lane(2), y.lane(3)};
+    out_lanes ol = {out.lane(0), out.lane(1), out.lane(2), out.lane(3)};
+    multiply_generic(active_kernels->multiply(x.size(), xl, yl, ol), x.size(), xl, yl, ol);
+}
+
+// out[i] = determinant of x[i]; out must have room for x.size() values.
+void determinant(const Matrix2x2Batch &x, double *out)
+{
+    in_lanes xl = {x.lane(0), x.lane(1), x.lane(2), x.lane(3)};
+    determinant_generic(active_kernels->determinant(x.size(), xl, out), x.size(), xl, out);
+}
+
+// out[i] = inverse of x[i]. Returns how many x[i] were singular.
+size_t inverse(const Matrix2x2Batch &x, Matrix2x2Batch &out)
+{
+    check_sizes(x.size(), out.size());
+    in_lanes xl = {x.lane(0), x.lane(1), x.lane(2), x.lane(3)};
+    out_lanes ol = {out.lane(0), out.lane(1), out.lane(2), out.lane(3)};
+    size_t singular = 0;
+    size_t done = active_kernels->inverse(x.size(), xl, ol, singular);
+    return singular + inverse_generic(done, x.size(), xl, ol);
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// Determinant and inverse of 2.cpp's Matrix, written the same way as its operators.
+double determinant(Matrix &m)
+{
+    return m[0][0] * m[1][1] - m[0][1] * m[1][0];
+}
+
+Matrix inverse(Matrix &m)
+{
+    double r = 1.0 / determinant(m);
+    return Matrix(m[1][1] * r, -m[0][1] * r, -m[1][0] * r, m[0][0] * r);
+}
+
+// Nanoseconds per matrix of f(), repeated until the batch has been processed about
+// 20 million times in total.
+template <class F>
+double ns_per_matrix(size_t n, F f)
+{
+    size_t reps = max<size_t>(1, 20000000 / n);
+    f(); // warm up: pages mapped, data in cache if it fits
+    double best = 1e30;
+    for (int round = 0; round < 3; round++)
+    {
+        auto start = chrono::steady_clock::now();
+        for (size_t r = 0; r < reps; r++)
+        {
+            f();
+            asm volatile("" ::: "memory");
+        }
+        best = min(best, chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (reps * n));
+    }
+    return best;
+}
+
+void run(size_t n)
+{
+    vector<Matrix> xs(n), ys(n), outs(n);
+    vector<double> dets(n);
+    Matrix2x2Batch x(n), y(n), out(n);
+    unsigned seed = 12345;
+    auto next = [&] { return double((seed = seed * 1664525u + 1013904223u) >> 8) / (1 << 24) - 0.5; };
+    for (size_t i = 0; i < n; i++)
+    {
+        xs[i] = Matrix(next(), next(), next(), next());
+        ys[i] = Matrix(next(), next(), next(), next());
+        x.set(i, xs[i]);
+        y.set(i, ys[i]);
+    }
+
+    printf("\n%zu matrices (%.1f MB per batch):\n", n, n * 32 / 1e6);
+    printf("%-22s %10s %10s %10s %10s   (ns per matrix)\n", "", "add", "multiply", "determinant", "inverse");
+    printf("%-22s %10.3f %10.3f %10.3f %10.3f\n", "array of Matrix",
+           ns_per_matrix(n, [&] { for (size_t i = 0; i < n; i++) outs[i] = xs[i] + ys[i]; }),
+           ns_per_matrix(n, [&] { for (size_t i = 0; i < n; i++) outs[i] = xs[i] * ys[i]; }),
+           ns_per_matrix(n, [&] { for (size_t i = 0; i < n; i++) dets[i] = determinant(xs[i]); }),
+           ns_per_matrix(n, [&] { for (size_t i = 0; i < n; i++) outs[i] = inverse(xs[i]); }));
+
+    for (const batch_kernels *k : supported_kernels())
+    {
+        active_kernels = k;
+        // Compare with the array of objects before timing: the batch kernels use FMA and
+        // 2.cpp does not, so the results may differ in the last bits.
+        double worst = 0;
+        multiply(x, y, out);
+        for (size_t i = 0; i < n; i++)
+        {
+            Matrix p = xs[i] * ys[i], q = out.get(i);
+            for (int r = 0; r < 2; r++)
+                for (int c = 0; c < 2; c++)
+                    worst = max(worst, fabs(p[r][c] - q[r][c]));
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "batch, %s", k->name);
+        printf("%-22s %10.3f %10.3f %10.3f %10.3f   max difference %.1e\n", label,
+               ns_per_matrix(n, [&] { add(x, y, out); }), ns_per_matrix(n, [&] { multiply(x, y, out); }),
+               ns_per_matrix(n, [&] { determinant(x, dets.data()); }),
+               ns_per_matrix(n, [&] { inverse(x, out); }), worst);
+    }
+    active_kernels = supported_kernels().front();
+}
+
+int main(int argc, char *argv[])
+{
+    // The example of 2.cpp, computed with a batch of two.
+    Matrix2x2Batch m(2), p(2);
+    m.set(0, Matrix(1, 2, 3, 4));
+    m.set(1, Matrix(5, 6, 7, 8));
+    multiply(m, m, p);
+    cout << "Kernels: " << active_kernels->name << "\nm0 * m0:" << endl;
+    Matrix r = p.get(0);
+    cout << r[0][0] << " " << r[0][1] << endl << r[1][0] << " " << r[1][1] << endl;
+    double dets[2];
+    determinant(m, dets);
+    cout << "det(m0) = " << dets[0] << ", det(m1) = " << dets[1] << endl;
+    inverse(m, p);
+    r = p.get(1);
+    cout << "inverse(m1):" << endl << r[0][0] << " " << r[0][1] << endl << r[1][0] << " " << r[1][1] << endl;
+
+    // Every version must round alike, down to which matrices count as singular (32
+    // copies, so that the SIMD kernels do them).
+    Matrix2x2Batch tenths(32), inverses(32);
+    for (size_t i = 0; i < tenths.size(); i++)
+        tenths.set(i, Matrix(0.1, 0.1, 0.1, 0.1));
+    cout << "Singular copies of [[0.1, 0.1], [0.1, 0.1]]:";
+    for (const batch_kernels *k : supported_kernels())
+    {
+        active_kernels = k;
+        cout << " " << inverse(tenths, inverses) << " (" << k->name << ")";
+    }
+    cout << endl;
+    active_kernels = supported_kernels().front();
+
+    size_t large = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    run(256);
+    run(large);
+    return 0;
+}
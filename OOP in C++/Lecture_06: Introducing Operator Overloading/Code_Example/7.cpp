@@ -0,0 +1,401 @@
+/*
+7. A linear recurrence such as the Fibonacci numbers
+        F(n+1) = F(n) + F(n-1)
+is one matrix product per step: (F(n+1), F(n)) = [[1, 1], [1, 0]] * (F(n), F(n-1)), so
+F(n) is found in the matrix [[1, 1], [1, 0]] raised to the power n. With the Matrix of
+Exams/Lab/Practice Exam/Test/4.cpp that means n - 1 calls of operator*, which is
+hopeless for n = 10^18.
+
+This program adds pow(Matrix, uint64_t) by binary exponentiation ("repeated squaring"):
+    M^13 = M^8 * M^4 * M^1        (13 = 1101 in binary)
+M^1, M^2, M^4, M^8, ... are each the square of the one before, so M^n needs at most
+2 * log2(n) products: 120 for n = 10^18 instead of 10^18.
+
+The numbers grow exponentially (F(90) no longer fits in 64 bits), so in practice they are
+computed modulo some m. pow(M, n, mod) does every product modulo m, and the entries stay
+below m < 2^31, so they always fit in an int. Computing x % m after every
+multiplication would be slow: a 64-bit division takes tens of cycles. Two classes avoid
+it, each with a reduce step built from multiplications and shifts only:
+  - barrett_mod (any m): precomputes k = floor((2^64 - 1) / m); the quotient q = x / m
+    is then (x * k) >> 64 or one more, so x % m = x - q * m, corrected once if needed.
+  - montgomery_mod (odd m): keeps every number a as a * 2^32 mod m ("Montgomery form").
+    The product of two such numbers is divided by 2^32 with REDC, which needs only a
+    multiplication by -1/m mod 2^32, and the division by 2^32 is a shift.
+
+pow_batch() raises many matrices to the same exponent. They share the sequence of
+squarings and multiplications, so each step runs over all of them: the products are
+independent, and the processor overlaps them instead of waiting for one to finish.
+
+Without a modulus the products wrap around modulo 2^32 like the hardware does; they are
+computed in unsigned arithmetic so that the overflow is not undefined behaviour.
+
+main() repeats the example of Test/4.cpp, checks pow() against repeated multiplication,
+compares their times for n = 10 .. 10^18 (repeated multiplication is timed up to 10^7
+and its time per product used beyond that), and compares pow_batch() with one pow() call
+per matrix.
+
+Compile and run with:
+    g++ -std=c++17 -O2 7.cpp -o matrix_pow
+    ./matrix_pow
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+using namespace std;
+
+// Declare an N x N matrix of ints, as in Test/4.cpp (where N is 2).
+template <int N = 2>
+class Matrix
+{
+    int mat[N][N];
+
+public:
+    Matrix()
+    {
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+                mat[i][j] = 0;
+    }
+
+    Matrix(const int m[N][N])
+    {
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+                mat[i][j] = m[i][j];
+    }
+
+    static Matrix identity()
+    {
+        Matrix r;
+        for (int i = 0; i < N; i++)
+            r.mat[i][i] = 1;
+        return r;
+    }
+
+    int *operator[](int row) { return mat[row]; }
+    const int *operator[](int row) const { return mat[row]; }
+
+    Matrix operator*(const Matrix &m2) const
+    {
+        Matrix temp;
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+            {
+                unsigned sum = 0; // wraps modulo 2^32
+                for (int k = 0; k < N; k++)
+                    sum += unsigned(mat[i][k]) * unsigned(m2.mat[k][j]);
+                temp.mat[i][j] = int(sum);
+            }
+        return temp;
+    }
+
+    bool operator==(const Matrix &other) const
+    {
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < N; j++)
+                if (mat[i][j] != other.mat[i][j])
+                    return false;
+        return true;
+    }
+
+    void display() const
+    {
+        for (int i = 0; i < N; i++)
+        {
+            for (int j = 0; j < N; j++)
+                cout << mat[i][j] << " ";
+            cout << endl;
+        }
+    }
+};
+
+// base^e by repeated squaring, with the wrapping product.
+template <int N>
+Matrix<N> pow(Matrix<N> base, uint64_t e)
+{
+    Matrix<N> result = Matrix<N>::identity();
+    while (e)
+    {
+        if (e & 1)
+            result = result * base;
+        e >>= 1;
+        if (e)
+            base = base * base;
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Modular arithmetic
+// ---------------------------------------------------------------------------
+
+// Declare arithmetic modulo m, 2 <= m < 2^31, with Barrett reduction. Numbers are kept as
+// themselves (to_form and from_form do nothing).
+class barrett_mod
+{
+    uint64_t m;
+    uint64_t k; // floor((2^64 - 1) / m)
+
+public:
+    explicit barrett_mod(uint32_t modulus) : m(modulus), k(~uint64_t(0) / modulus) {}
+    uint32_t modulus() const { return uint32_t(m); }
+    const char *name() const { return "Barrett"; }
+
+    uint32_t to_form(uint64_t a) const { return uint32_t(a % m); }
+    uint32_t from_form(uint32_t a) const { return a; }
+    // x % m for any 64-bit x: x * k / 2^64 is less than x / m by less than 1.
+    uint32_t reduce(uint64_t x) const
+    {
+        uint64_t q = uint64_t((unsigned __int128)x * k >> 64); // x / m, or one less
+        uint64_t r = x - q * m;
+        return uint32_t(r >= m ? r - m : r);
+    }
+    uint32_t mul(uint32_t a, uint32_t b) const { return reduce(uint64_t(a) * b); }
+    uint32_t add(uint32_t a, uint32_t b) const
+    {
+        uint32_t s = a + b; // < 2^32 because both are < 2^31
+        return s >= m ? s - uint32_t(m) : s;
+    }
+};
+
+// Declare arithmetic modulo an odd m, 2 < m < 2^31, with Montgomery reduction. A number a
+// is kept as a * 2^32 mod m.
+class montgomery_mod
+{
+    uint32_t m;
+    uint32_t neg_inv; // -1/m mod 2^32
+    uint32_t r2;      // 2^64 mod m, to convert into Montgomery form
+
+public:
+    explicit montgomery_mod(uint32_t modulus) : m(modulus)
+    {
+        // Newton's iteration: each step doubles the number of correct low bits of 1/m.
+        uint32_t inv = m; // correct to 3 bits, since m * m = 1 mod 8 for odd m
+        for (int i = 0; i < 4; i++)
+            inv *= 2 - m * inv;
+        neg_inv = 0 - inv;
+        r2 = uint32_t(((unsigned __int128)1 << 64) % m);
+    }
+    uint32_t modulus() const { return m; }
+    const char *name() const { return "Montgomery"; }
+
+    // REDC: x / 2^32 mod m, for x < m * 2^32. Adding q * m makes the low 32 bits zero.
+    uint32_t reduce(uint64_t x) const
+    {
+        uint32_t q = uint32_t(x) * neg_inv;
+        uint64_t t = (x + uint64_t(q) * m) >> 32; // < 2m, and no overflow since m < 2^31
+        return uint32_t(t >= m ? t - m : t);
+    }
+    uint32_t to_form(uint64_t a) const { return reduce(uint64_t(uint32_t(a % m)) * r2); }
+    uint32_t from_form(uint32_t a) const { return reduce(a); }
+    uint32_t mul(uint32_t a, uint32_t b) const { return reduce(uint64_t(a) * b); }
+    uint32_t add(uint32_t a, uint32_t b) const
+    {
+        uint32_t s = a + b;
+        return s >= m ? s - m : s;
+    }
+};
+
+// The entries of a matrix while it is being raised to a power modulo m.
+template <int N>
+struct mod_matrix
+{
+    uint32_t v[N][N];
+};
+
+template <int N, class Mod>
+mod_matrix<N> to_form(const Matrix<N> &a, const Mod &mod)
+{
+    mod_matrix<N> r;
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+        {
+            long long x = a[i][j] % (long long)mod.modulus(); // negative entries too
+            r.v[i][j] = mod.to_form(uint64_t(x < 0 ? x + mod.modulus() : x));
+        }
+    return r;
+}
+
+template <int N, class Mod>
+Matrix<N> from_form(const mod_matrix<N> &a, const Mod &mod)
+{
+    Matrix<N> r;
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            r[i][j] = int(mod.from_form(a.v[i][j]));
+    return r;
+}
+
+template <int N, class Mod>
+mod_matrix<N> mod_identity(const Mod &mod)
+{
+    mod_matrix<N> r = {};
+    for (int i = 0; i < N; i++)
+        r.v[i][i] = mod.to_form(1);
+    return r;
+}
+
+// a * b modulo m. For 2x2 the sum of two products is below 2 m^2 < 2^63, so it is reduced
+// once; larger sizes reduce every product.
+template <int N, class Mod>
+mod_matrix<N> multiply(const mod_matrix<N> &a, const mod_matrix<N> &b, const Mod &mod)
+{
+    mod_matrix<N> r;
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+        {
+            if (N == 2)
+                r.v[i][j] = mod.reduce(uint64_t(a.v[i][0]) * b.v[0][j] + uint64_t(a.v[i][1]) * b.v[1][j]);
+            else
+            {
+                uint32_t sum = 0;
+                for (int k = 0; k < N; k++)
+                    sum = mod.add(sum, mod.mul(a.v[i][k], b.v[k][j]));
+                r.v[i][j] = sum;
+            }
+        }
+    return r;
+}
+
+// base^e modulo mod.modulus(), with every entry reduced into [0, m).
+template <int N, class Mod>
+Matrix<N> pow(const Matrix<N> &base, uint64_t e, const Mod &mod)
+{
+    mod_matrix<N> b = to_form(base, mod), result = mod_identity<N>(mod);
+    while (e)
+    {
+        if (e & 1)
+            result = multiply(result, b, mod);
+        e >>= 1;
+        if (e)
+            b = multiply(b, b, mod);
+    }
+    return from_form(result, mod);
+}
+
+// out[i] = bases[i]^e modulo mod.modulus() for i < count. Every step of the exponent is
+// applied to all the matrices before the next step.
+template <int N, class Mod>
+void pow_batch(const Matrix<N> *bases, size_t count, uint64_t e, const Mod &mod, Matrix<N> *out)
+{
+    vector<mod_matrix<N>> b(count), result(count, mod_identity<N>(mod));
+    for (size_t i = 0; i < count; i++)
+        b[i] = to_form(bases[i], mod);
+    while (e)
+    {
+        if (e & 1)
+            for (size_t i = 0; i < count; i++)
+                result[i] = multiply(result[i], b[i], mod);
+        e >>= 1;
+        if (e)
+            for (size_t i = 0; i < count; i++)
+                b[i] = multiply(b[i], b[i], mod);
+    }
+    for (size_t i = 0; i < count; i++)
+        out[i] = from_form(result[i], mod);
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+// base^e by e - 1 products, modulo m with the % operator: what Test/4.cpp allows.
+Matrix<2> pow_iterative(const Matrix<2> &base, uint64_t e, uint32_t m)
+{
+    Matrix<2> result = Matrix<2>::identity();
+    for (uint64_t s = 0; s < e; s++)
+    {
+        Matrix<2> r;
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                r[i][j] = int((uint64_t(result[i][0]) * unsigned(base[0][j]) +
+                               uint64_t(result[i][1]) * unsigned(base[1][j])) % m);
+        result = r;
+    }
+    return result;
+}
+
+template <class F>
+double ns_per_call(F f, int calls)
+{
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++)
+        f();
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+}
+
+int main()
+{
+    // The example of Test/4.cpp.
+    int a[2][2] = {{1, 2}, {3, 4}};
+    int b[2][2] = {{2, 0}, {1, 2}};
+    Matrix<2> m1(a), m2(b), m3;
+    m3 = m1 * m2;
+    cout << "Product of matrices:\n";
+    m3.display();
+    cout << "m1^5:\n";
+    pow(m1, 5).display();
+
+    const uint32_t p = 1000000007;
+    barrett_mod barrett(p);
+    montgomery_mod montgomery(p);
+    int fib[2][2] = {{1, 1}, {1, 0}};
+    Matrix<2> f(fib);
+
+    // pow() must agree with repeated multiplication, for both reductions.
+    bool ok = true;
+    for (uint64_t n : {0ull, 1ull, 2ull, 3ull, 10ull, 63ull, 64ull, 1000ull, 123457ull})
+    {
+        Matrix<2> expected = pow_iterative(f, n, p);
+        ok = ok && pow(f, n, barrett) == expected && pow(f, n, montgomery) == expected;
+    }
+    // Even moduli and negative entries go through Barrett.
+    int neg[2][2] = {{-3, 7}, {5, -11}};
+    ok = ok && pow(Matrix<2>(neg), 1000, barrett_mod(1u << 30)) == pow_iterative(Matrix<2>(neg), 1000, 1u << 30);
+    cout << "\npow() agrees with repeated multiplication: " << (ok ? "yes" : "NO") << "\n";
+    cout << "F(10^18) mod 10^9+7 = " << pow(f, 1000000000000000000ull, montgomery)[0][1] << "\n\n";
+
+    printf("%22s %14s %14s %14s %18s\n", "n", "products", "Barrett ns", "Montgomery ns", "repeated mult. ns");
+    double per_product = 0;
+    volatile unsigned sink = 0; // keeps the timed results from being optimized away
+    for (uint64_t n = 10; n <= 1000000000000000000ull; n *= 10)
+    {
+        int products = 0;
+        for (uint64_t e = n; e; e >>= 1)
+            products += (e & 1) + (e > 1);
+        double tb = ns_per_call([&] { sink = sink + unsigned(pow(f, n, barrett)[0][1]); }, 200000);
+        double tm = ns_per_call([&] { sink = sink + unsigned(pow(f, n, montgomery)[0][1]); }, 200000);
+        char iterative[32];
+        if (n <= 10000000)
+        {
+            double t = ns_per_call([&] { sink = sink + unsigned(pow_iterative(f, n, p)[0][1]); },
+                                   n <= 100000 ? 20 : 1);
+            per_product = t / n;
+            snprintf(iterative, sizeof(iterative), "%.0f", t);
+        }
+        else
+            snprintf(iterative, sizeof(iterative), "~%.1e", per_product * n);
+        printf("%22llu %14d %14.1f %14.1f %18s\n", (unsigned long long)n, products, tb, tm, iterative);
+    }
+
+    // 4096 random 2x2 matrices to the power 10^18.
+    const size_t count = 4096;
+    const uint64_t e = 1000000000000000000ull;
+    vector<Matrix<2>> bases(count), out(count), check(count);
+    unsigned seed = 1;
+    for (auto &m : bases)
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                m[i][j] = int((seed = seed * 1664525u + 1013904223u) >> 2);
+    double one_by_one = ns_per_call([&] {
+        for (size_t i = 0; i < count; i++)
+            check[i] = pow(bases[i], e, montgomery);
+    }, 20) / count;
+    double batched = ns_per_call([&] { pow_batch(bases.data(), count, e, montgomery, out.data()); }, 20) / count;
+    cout << "\n" << count << " matrices to the power 10^18 (Montgomery), ns per matrix: one pow() each "
+         << one_by_one << ", pow_batch() " << batched << (out == check ? "" : "  (RESULTS DIFFER)") << "\n";
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,528 @@
+/*
+9. The matrices of 2.cpp and 4.cpp are built from numbers written in main(). Real programs
+load them from files, and a text file of numbers is slow to load: every element has to
+be parsed with strtod(), which costs more than reading its bytes from the disk, and a
+double takes about 20 characters of text instead of 8 bytes.
+
+This program defines a small binary format instead. A file is
+    a 64-byte header:  magic "CPPMATRX", format version, element type (dtype), rows,
+                       cols, the alignment of the data, where the data start, a
+                       checksum of the data and a checksum of the header
+    padding up to the alignment (4096 bytes, one page)
+    the elements, row by row, exactly as they are in memory
+so loading it needs no parsing at all. The numbers are stored in the byte order of the
+machine that wrote the file (little-endian on x86 and ARM); a file from a machine with
+the other byte order fails the version check.
+
+write_matrix() writes a Matrix. MappedMatrix opens a file with mmap(): the file is mapped
+into the address space read-only, and its pages are read from the disk (or taken from
+the operating system's file cache) only when they are first touched. Opening is
+therefore instant whatever the size, the data are never copied, and several processes
+that open the same file share one copy in memory. A MappedMatrix is a read-only view
+with the same rows(), cols() and operator[] as Matrix.
+  - open() checks the header (magic, version, dtype, sizes against the file size, the
+    header checksum) but not the data checksum, which would mean reading everything;
+    verify() does that when it is wanted.
+  - advise() passes a hint to madvise(): sequential (read ahead aggressively and drop
+    pages behind), random (no read-ahead), or willneed (start reading everything now).
+
+main() writes an n x n matrix in both formats, then compares the time to load it from
+text, from the binary file with read(), and through mmap(), each with the file in the
+operating system's cache (warm) and after evicting it (cold). The default n = 4096 is a
+128 MB matrix; n = 23170 gives the 4 GB case (it needs as much free disk space, about
+twice that again for the text file, and minutes to parse the text).
+
+This program needs Linux (or another POSIX system). Compile and run with:
+    g++ -std=c++17 -O2 9.cpp -o matrix_file
+    ./matrix_file [n] [directory]
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+void *aligned_or_exit(size_t bytes)
+{
+    // aligned_alloc() needs a size that is a multiple of the alignment.
+    void *p = aligned_alloc(64, (bytes + 63) / 64 * 64 + 64);
+    if (!p)
+    {
+        cout << " Allocation error \n";
+        exit(1);
+    }
+    return p;
+}
+
+// Declare a dense matrix of doubles whose size is chosen at run time, as in 4.cpp.
+class Matrix
+{
+    int nrows, ncols;
+    double *data; // row-major, 64-byte aligned
+
+public:
+    Matrix(int rows = 0, int cols = 0);
+    Matrix(Matrix &&other) noexcept;
+    Matrix &operator=(Matrix &&other) noexcept;
+    ~Matrix() { free(data); }
+
+    int rows() const { return nrows; }
+    int cols() const { return ncols; }
+    double *operator[](int row) { return data + size_t(row) * ncols; } // access row as array
+    const double *operator[](int row) const { return data + size_t(row) * ncols; }
+};
+
+Matrix::Matrix(int rows, int cols) : nrows(rows), ncols(cols)
+{
+    size_t bytes = size_t(rows) * cols * sizeof(double);
+    data = (double *)aligned_or_exit(bytes);
+    memset(data, 0, bytes);
+}
+
+Matrix::Matrix(Matrix &&other) noexcept : nrows(other.nrows), ncols(other.ncols), data(other.data)
+{
+    other.nrows = other.ncols = 0;
+    other.data = nullptr;
+}
+
+Matrix &Matrix::operator=(Matrix &&other) noexcept
+{
+    swap(nrows, other.nrows);
+    swap(ncols, other.ncols);
+    swap(data, other.data);
+    return *this;
+}
+
+// ---------------------------------------------------------------------------
+// File format
+// ---------------------------------------------------------------------------
+
+const char MATRIX_MAGIC[8] = {'C', 'P', 'P', 'M', 'A', 'T', 'R', 'X'};
+const uint32_t MATRIX_VERSION = 1;
+const uint32_t MATRIX_ALIGNMENT = 4096;
+
+enum matrix_dtype : uint32_t
+{
+    DTYPE_FLOAT64 = 1,
+    DTYPE_FLOAT32 = 2,
+    DTYPE_INT32 = 3,
+    DTYPE_INT64 = 4
+};
+
+// The header, exactly as stored at the start of the file.
+struct matrix_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint64_t rows;
+    uint64_t cols;
+    uint32_t alignment;       // data_offset is a multiple of this
+    uint32_t flags;           // 0; for later versions
+    uint64_t data_offset;     // bytes from the start of the file
+    uint64_t data_checksum;   // checksum64() of the data
+    uint64_t header_checksum; // checksum64() of the bytes above
+};
+static_assert(sizeof(matrix_header) == 64, "the header must have no padding");
+
+// A checksum that keeps up with memory: four independent lanes of multiply-and-rotate
+// over 64-bit words, combined at the end. Not cryptographic; it catches truncated,
+// overwritten and corrupted files.
+uint64_t checksum64(const void *p, size_t bytes)
+{
+    const uint64_t K1 = 0x9E3779B185EBCA87ull, K2 = 0xC2B2AE3D27D4EB4Full;
+    const unsigned char *s = (const unsigned char *)p;
+    uint64_t h[4] = {K1, K2, ~K1, ~K2};
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32)
+        for (int k = 0; k < 4; k++)
+        {
+            uint64_t w;
+            memcpy(&w, s + i + 8 * k, 8);
+            uint64_t x = h[k] ^ (w * K2);
+            h[k] = (x << 31 | x >> 33) * K1;
+        }
+    uint64_t r = bytes * K1;
+    for (int k = 0; k < 4; k++)
+        r = (r ^ h[k]) * K2 + (r >> 29);
+    for (; i < bytes; i++)
+        r = (r ^ s[i]) * K1;
+    return r ^ (r >> 32);
+}
+
+// Write m to path. Prints the reason and returns false on failure.
+bool write_matrix(const char *path, const Matrix &m)
+{
+    matrix_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MATRIX_MAGIC, sizeof(h.magic));
+    h.version = MATRIX_VERSION;
+    h.dtype = DTYPE_FLOAT64;
+    h.rows = uint64_t(m.rows());
+    h.cols = uint64_t(m.cols());
+    h.alignment = MATRIX_ALIGNMENT;
+    h.data_offset = MATRIX_ALIGNMENT;
+    size_t data_bytes = size_t(h.rows * h.cols * sizeof(double));
+    h.data_checksum = checksum64(data_bytes ? m[0] : nullptr, data_bytes);
+    h.header_checksum = checksum64(&h, offsetof(matrix_header, header_checksum));
+
+    FILE *out = fopen(path, "wb");
+    if (!out)
+    {
+        cout << " Cannot create " << path << " \n";
+        return false;
+    }
+    static const char padding[MATRIX_ALIGNMENT] = {};
+    bool ok = fwrite(&h, sizeof(h), 1, out) == 1 && fwrite(padding, h.data_offset - sizeof(h), 1, out) == 1 &&
+              (!data_bytes || fwrite(m[0], data_bytes, 1, out) == 1);
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        cout << " Cannot write " << path << " \n";
+    return ok;
+}
+
+// Check a header read from a file of file_bytes bytes. Prints the reason for rejecting it.
+bool check_header(const matrix_header &h, uint64_t file_bytes, const char *path)
+{
+    const char *error = nullptr;
+    if (memcmp(h.magic, MATRIX_MAGIC, sizeof(h.magic)))
+        error = "is not a matrix file";
+    else if (h.version != MATRIX_VERSION)
+        error = "has an unknown version (or the other byte order)";
+    else if (h.header_checksum != checksum64(&h, offsetof(matrix_header, header_checksum)))
+        error = "has a damaged header";
+    else if (h.dtype != DTYPE_FLOAT64)
+        error = "does not hold doubles";
+    else if (h.rows > 0x7fffffff || h.cols > 0x7fffffff ||
+             h.rows * h.cols > uint64_t(SIZE_MAX) / sizeof(double))
+        error = "has impossible sizes";
+    else if (!h.alignment || h.data_offset % h.alignment || h.data_offset < sizeof(h) ||
+             h.data_offset % sizeof(double))
+        error = "has misaligned data";
+    else if (h.data_offset > file_bytes || file_bytes - h.data_offset < h.rows * h.cols * sizeof(double))
+        error = "is truncated";
+    if (error)
+        cout << " " << path << " " << error << " \n";
+    return !error;
+}
+
+// Read path into m with read(), copying the data. Prints the reason and returns false on
+// failure.
+bool read_matrix(const char *path, Matrix &m)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        cout << " Cannot open " << path << " \n";
+        return false;
+    }
+    struct stat st;
+    matrix_header h;
+    bool ok = fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == ssize_t(sizeof(h)) &&
+              check_header(h, uint64_t(st.st_size), path);
+    if (ok)
+    {
+        Matrix r(int(h.rows), int(h.cols));
+        size_t bytes = size_t(h.rows * h.cols * sizeof(double));
+        char *dst = bytes ? (char *)r[0] : nullptr;
+        for (size_t done = 0; ok && done < bytes;)
+        {
+            // pread() may return less than asked for; large reads are also split up.
+            ssize_t got = pread(fd, dst + done, min<size_t>(bytes - done, 1 << 30), off_t(h.data_offset + done));
+            ok = got > 0;
+            done += ok ? size_t(got) : 0;
+        }
+        ok = ok && checksum64(dst, bytes) == h.data_checksum;
+        if (!ok)
+            cout << " Cannot read " << path << " \n";
+        else
+            m = std::move(r);
+    }
+    close(fd);
+    return ok;
+}
+
+enum access_hint
+{
+    ACCESS_NORMAL,
+    ACCESS_SEQUENTIAL,
+    ACCESS_RANDOM,
+    ACCESS_WILLNEED
+};
+
+// Declare a read-only view of a matrix file mapped into memory.
+class MappedMatrix
+{
+    void *map;
+    size_t map_bytes;
+    matrix_header header;
+    const double *data;
+
+public:
+    MappedMatrix() : map(nullptr), map_bytes(0), data(nullptr) { memset(&header, 0, sizeof(header)); }
+    ~MappedMatrix() { close(); }
+    MappedMatrix(const MappedMatrix &) = delete;
+    MappedMatrix &operator=(const MappedMatrix &) = delete;
+
+    // Map path and check its header. Prints the reason and returns false on failure.
+    bool open(const char *path, access_hint hint = ACCESS_NORMAL);
+    void close();
+    void advise(access_hint hint) const;
+    bool verify() const; // compares the data with the checksum in the header (reads it all)
+
+    int rows() const { return int(header.rows); }
+    int cols() const { return int(header.cols); }
+    const double *operator[](int row) const { return data + size_t(row) * header.cols; }
+};
+
+bool MappedMatrix::open(const char *path, access_hint hint)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        cout << " Cannot open " << path << " \n";
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(matrix_header);
+    if (!ok)
+        cout << " " << path << " is not a matrix file \n";
+    if (ok)
+    {
+        map_bytes = size_t(st.st_size);
+        map = mmap(nullptr, map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ok = map != MAP_FAILED;
+        if (!ok)
+        {
+            cout << " Cannot map " << path << " \n";
+            map = nullptr;
+        }
+    }
+    ::close(fd); // the mapping keeps the file open
+    if (ok)
+    {
+        memcpy(&header, map, sizeof(header));
+        ok = check_header(header, map_bytes, path);
+        if (!ok)
+            close();
+    }
+    if (!ok)
+        return false;
+    data = (const double *)((const char *)map + header.data_offset);
+    advise(hint);
+    return true;
+}
+
+void MappedMatrix::close()
+{
+    if (map)
+        munmap(map, map_bytes);
+    map = nullptr;
+    map_bytes = 0;
+    data = nullptr;
+    memset(&header, 0, sizeof(header));
+}
+
+void MappedMatrix::advise(access_hint hint) const
+{
+    static const int advice[] = {MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED};
+    if (map)
+        madvise(map, map_bytes, advice[hint]);
+}
+
+bool MappedMatrix::verify() const
+{
+    return map && checksum64(data, size_t(header.rows * header.cols * sizeof(double))) == header.data_checksum;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark
+// ---------------------------------------------------------------------------
+
+bool write_text(const char *path, const Matrix &m)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+        return false;
+    fprintf(out, "%d %d\n", m.rows(), m.cols());
+    for (int i = 0; i < m.rows(); i++)
+        for (int j = 0; j < m.cols(); j++)
+            fprintf(out, "%.17g%c", m[i][j], j + 1 < m.cols() ? ' ' : '\n');
+    return fclose(out) == 0;
+}
+
+// Parse a text file into m with strtod(), reading it in large blocks.
+bool read_text(const char *path, Matrix &m)
+{
+    FILE *in = fopen(path, "r");
+    int rows, cols;
+    if (!in || fscanf(in, "%d %d", &rows, &cols) != 2 || rows < 0 || cols < 0)
+    {
+        if (in)
+            fclose(in);
+        return false;
+    }
+    Matrix r(rows, cols);
+    double *out = rows && cols ? r[0] : nullptr;
+    size_t count = size_t(rows) * cols, done = 0;
+    string buf(1 << 20, '\0');
+    size_t have = 0;
+    bool eof = false;
+    while (done < count)
+    {
+        // Keep at least one whole number in the buffer: refill when fewer than 64 bytes remain.
+        if (!eof && have < 64)
+        {
+            size_t n = fread(&buf[have], 1, buf.size() - 1 - have, in);
+            eof = n == 0;
+            have += n;
+            buf[have] = '\0';
+        }
+        char *start = &buf[0], *end;
+        size_t consumed = 0;
+        while (done < count && (eof || have - consumed >= 64))
+        {
+            double v = strtod(start + consumed, &end);
+            if (end == start + consumed)
+                break;
+            out[done++] = v;
+            consumed = size_t(end - start);
+        }
+        // No number parsed although a whole one was there to read (or nothing more is
+        // coming): more input cannot help, the file is malformed.
+        if (consumed == 0 && (eof || have >= 64))
+            break;
+        memmove(&buf[0], &buf[consumed], have - consumed);
+        have -= consumed;
+        buf[have] = '\0';
+    }
+    fclose(in);
+    if (done != count)
+        return false;
+    m = std::move(r);
+    return true;
+}
+
+// Drop a file's pages from the operating system's cache, so the next read comes from the
+// disk. Needs no special permission: the pages are written first, then discarded.
+void evict(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+double ms_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+double sum_all(const MappedMatrix &m)
+{
+    double s = 0;
+    for (int i = 0; i < m.rows(); i++)
+        for (int j = 0; j < m.cols(); j++)
+            s += m[i][j];
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 4096;
+    string dir = argc > 2 ? argv[2] : ".";
+    string bin = dir + "/matrix.bin", text = dir + "/matrix.txt";
+
+    // Random doubles with all 17 digits, as measured data would have.
+    Matrix m(n, n);
+    double expected = 0;
+    uint64_t seed = 88172645463325252ull;
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            m[i][j] = double(seed >> 11) / double(1ull << 53) * 200 - 100;
+            expected += m[i][j];
+        }
+    if (!write_matrix(bin.c_str(), m) || !write_text(text.c_str(), m))
+        return 1;
+    struct stat bs, ts;
+    stat(bin.c_str(), &bs);
+    stat(text.c_str(), &ts);
+    cout << n << " x " << n << " matrix of doubles: binary file " << bs.st_size / 1e6 << " MB, text file "
+         << ts.st_size / 1e6 << " MB\n\n";
+
+    // Damaged files must be rejected: flip one byte of the data, and cut the file short.
+    {
+        string bad = dir + "/matrix_bad.bin";
+        Matrix small(3, 3);
+        write_matrix(bad.c_str(), small);
+        FILE *f = fopen(bad.c_str(), "r+b");
+        if (!f || fseek(f, MATRIX_ALIGNMENT + 5, SEEK_SET) || fputc(1, f) == EOF || fclose(f))
+            return 1;
+        MappedMatrix mm;
+        cout << "Corrupted data: open " << (mm.open(bad.c_str()) ? "ok" : "rejected") << ", verify "
+             << (mm.verify() ? "ok (WRONG)" : "fails") << "\n";
+        if (truncate(bad.c_str(), MATRIX_ALIGNMENT + 40))
+            return 1;
+        cout << "Truncated file:";
+        bool opened = mm.open(bad.c_str());
+        cout << (opened ? " opened (WRONG)\n" : "");
+        remove(bad.c_str());
+    }
+
+    printf("\n%-40s %12s %12s\n", "milliseconds", "cold cache", "warm cache");
+    for (int test = 0; test < 5; test++)
+    {
+        const char *names[] = {"text: parse with strtod()", "binary: read() into a Matrix", "binary: mmap() open only",
+                               "binary: mmap() open + sum (sequential)", "binary: mmap() open + verify()"};
+        double times[2];
+        bool ok = true;
+        for (int warm = 0; warm < 2; warm++)
+        {
+            if (!warm)
+                evict(test == 0 ? text.c_str() : bin.c_str());
+            auto start = chrono::steady_clock::now();
+            if (test == 0)
+            {
+                Matrix r;
+                ok = read_text(text.c_str(), r) && r[n - 1][n - 1] == m[n - 1][n - 1];
+            }
+            else if (test == 1)
+            {
+                Matrix r;
+                ok = read_matrix(bin.c_str(), r) && r[n - 1][n - 1] == m[n - 1][n - 1];
+            }
+            else
+            {
+                MappedMatrix mm;
+                ok = mm.open(bin.c_str(), test == 3 ? ACCESS_SEQUENTIAL : ACCESS_NORMAL);
+                if (ok && test == 3)
+                    ok = sum_all(mm) == expected;
+                if (ok && test == 4)
+                    ok = mm.verify();
+            }
+            times[warm] = ms_since(start);
+        }
+        printf("%-40s %12.3f %12.3f%s\n", names[test], times[0], times[1], ok ? "" : "  (FAILED)");
+    }
+
+    remove(bin.c_str());
+    remove(text.c_str());
+    return 0;
+}